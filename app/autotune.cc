@@ -0,0 +1,215 @@
+/* This is licensed software, @see LICENSE file.
+ * Authors - @see AUTHORS file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <opencv2/core.hpp>
+
+#include <lib/libbackscrub.h>
+#include "autotune.h"
+
+// Bundled models, most accurate first. The first model that reaches the
+// target frame rate in any configuration wins.
+static const char *models[] = {
+    "selfiesegmentation_mlkit-256x256-2021_01_19-v1215.f16.tflite",
+    "segm_full_v679.tflite",
+    "deeplabv3_257_mv_gpu.tflite",
+    "segm_lite_v681.tflite",
+    "body-pix-float-050-8.tflite",
+};
+
+// timed iterations per configuration, after a few untimed warm-up runs
+static const int warmup = 3;
+static const int iterations = 10;
+// required headroom over the target when choosing fewer threads
+static const double headroom = 1.1;
+
+// CPU identification for the cache key
+static std::string cpu_model() {
+    std::ifstream info("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(info, line)) {
+        // x86: 'model name', ARM: 'Model' (Raspberry Pi) or 'Hardware'
+        if (line.rfind("model name", 0) == 0 || line.rfind("Model", 0) == 0 || line.rfind("Hardware", 0) == 0) {
+            size_t pos = line.find(':');
+            if (pos != line.npos && pos + 2 < line.size())
+                return line.substr(pos + 2);
+        }
+    }
+    return "unknown";
+}
+
+static std::string cache_path() {
+    std::string base = getenv("XDG_CACHE_HOME") ? getenv("XDG_CACHE_HOME") :
+        std::string() + (getenv("HOME") ? getenv("HOME") : "/tmp") + "/.cache";
+    mkdir(base.c_str(), 0755);
+    base += "/backscrub";
+    mkdir(base.c_str(), 0755);
+    return base + "/autotune";
+}
+
+// Cache lines: <key> TAB <model> TAB <threads> TAB <xnnpack> TAB <fps>
+static bool cache_read(const std::string& path, const std::string& key, autotune_t& out) {
+    std::ifstream cache(path);
+    std::string line;
+    while (std::getline(cache, line)) {
+        std::istringstream cols(line);
+        std::string k, model, threads, xnnpack, fps;
+        if (!std::getline(cols, k, '\t') || k != key)
+            continue;
+        if (!std::getline(cols, model, '\t') || !std::getline(cols, threads, '\t') ||
+            !std::getline(cols, xnnpack, '\t') || !std::getline(cols, fps, '\t'))
+            continue;
+        out.model = model;
+        out.threads = std::max(1, atoi(threads.c_str()));
+        out.xnnpack = xnnpack == "1";
+        out.fps = atof(fps.c_str());
+        return true;
+    }
+    return false;
+}
+
+static void cache_write(const std::string& path, const std::string& key, const autotune_t& res) {
+    // keep results for other keys
+    std::vector<std::string> lines;
+    {
+        std::ifstream cache(path);
+        std::string line;
+        while (std::getline(cache, line)) {
+            if (line.rfind(key + "\t", 0) != 0)
+                lines.push_back(line);
+        }
+    }
+    std::ofstream cache(path, std::ios::trunc);
+    for (auto& line : lines)
+        cache << line << "\n";
+    char fps[32];
+    snprintf(fps, sizeof(fps), "%.2f", res.fps);
+    cache << key << "\t" << res.model << "\t" << res.threads << "\t" << (res.xnnpack ? 1 : 0) << "\t" << fps << "\n";
+    if (!cache.good())
+        fprintf(stderr, "autotune: warning: unable to write cache file: %s\n", path.c_str());
+}
+
+// Time one configuration, returns batches (masks per stream) per second, or
+// <0 if the model cannot be loaded. Reports if the delegate was applied.
+static double measure(const std::string& path, const bs_maskgen_opts_t& opts, std::vector<cv::Mat>& frames, bool& delegated) {
+    void *ctx = bs_maskgen_new(path, opts, frames[0].cols, frames[0].rows, nullptr, nullptr, nullptr, nullptr, nullptr);
+    if (!ctx)
+        return -1;
+    bs_delegate_info_t info;
+    bs_maskgen_delegate_info(ctx, info);
+    delegated = info.active;
+    std::vector<cv::Mat> masks(frames.size());
+    auto run = [&]() {
+        return frames.size() > 1 ?
+            bs_maskgen_process_batch(ctx, frames, masks) :
+            bs_maskgen_process(ctx, frames[0], masks[0]);
+    };
+    double fps = -1;
+    bool ok = true;
+    for (int i = 0; ok && i < warmup; i++)
+        ok = run();
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; ok && i < iterations; i++)
+        ok = run();
+    if (ok) {
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        fps = iterations / std::max(secs, 1e-9);
+    }
+    bs_maskgen_delete(ctx);
+    return fps;
+}
+
+bool autotune(double target_fps, size_t width, size_t height, size_t streams, size_t max_threads,
+    const std::function<std::optional<std::string>(const std::string&)>& resolve,
+    const cv::Mat& sample, int debug, autotune_t& out) {
+    max_threads = std::max((size_t)1, max_threads);
+    streams = std::max((size_t)1, streams);
+    // cache key: everything that changes the measurement
+    char key[512];
+    snprintf(key, sizeof(key), "%s|%u cores|tflite %s|%zux%zu|%zu streams|%zu threads|%.2f fps",
+        cpu_model().c_str(), std::thread::hardware_concurrency(), bs_tensorflow_version(),
+        width, height, streams, max_threads, target_fps);
+    std::string path = cache_path();
+    if (cache_read(path, key, out) && resolve(out.model)) {
+        printf("autotune: cached: %s threads:%zu xnnpack:%s (%.2f fps)\n",
+            out.model.c_str(), out.threads, out.xnnpack ? "on" : "off", out.fps);
+        return true;
+    }
+
+    // frames to time with: captured sample or synthetic noise
+    cv::Mat frame;
+    if (!sample.empty() && sample.cols == (int)width && sample.rows == (int)height) {
+        frame = sample.clone();
+    } else {
+        frame = cv::Mat(height, width, CV_8UC3);
+        cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(255));
+    }
+    std::vector<cv::Mat> frames(streams, frame);
+
+    // thread counts to try: powers of two up to (and including) the budget
+    std::vector<size_t> thread_counts;
+    for (size_t t = 1; t < max_threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    printf("autotune: measuring for %.2f fps at %zux%zu (%zu stream(s), up to %zu threads)\n",
+        target_fps, width, height, streams, max_threads);
+    bool found = false;
+    autotune_t fastest = { "", 0, false, -1 };
+    for (const char *model : models) {
+        auto mpath = resolve(model);
+        if (!mpath)
+            continue;
+        // per model: cheapest configuration with headroom, and the fastest one
+        autotune_t cheapest = { "", 0, false, -1 };
+        autotune_t best = { "", 0, false, -1 };
+        for (bool xnnpack : { true, false }) {
+            for (size_t threads : thread_counts) {
+                bs_maskgen_opts_t opts;
+                opts.threads = threads;
+                opts.xnnpack = xnnpack;
+                bool delegated = false;
+                double fps = measure(mpath.value(), opts, frames, delegated);
+                if (debug)
+                    printf("autotune: %s threads:%zu xnnpack:%s => %.2f fps\n",
+                        model, threads, delegated ? "on" : "off", fps);
+                if (fps < 0)
+                    break;
+                // delegate unavailable: the same as the xnnpack=false runs
+                if (xnnpack && !delegated)
+                    break;
+                autotune_t res = { model, threads, xnnpack, fps };
+                if (fps > best.fps)
+                    best = res;
+                if (fps >= target_fps * headroom && (cheapest.fps < 0 || threads < cheapest.threads))
+                    cheapest = res;
+            }
+        }
+        if (best.fps > fastest.fps)
+            fastest = best;
+        if (best.fps >= target_fps) {
+            out = cheapest.fps >= 0 ? cheapest : best;
+            found = true;
+            break;
+        }
+    }
+    if (fastest.fps < 0) {
+        fprintf(stderr, "autotune: error: no usable model found\n");
+        return false;
+    }
+    if (!found) {
+        fprintf(stderr, "autotune: warning: no configuration reaches %.2f fps, using the fastest\n", target_fps);
+        out = fastest;
+    }
+    printf("autotune: chosen: %s threads:%zu xnnpack:%s (%.2f fps)\n",
+        out.model.c_str(), out.threads, out.xnnpack ? "on" : "off", out.fps);
+    cache_write(path, key, out);
+    return true;
+}
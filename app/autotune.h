@@ -0,0 +1,35 @@
+/* This is licensed software, @see LICENSE file.
+ * Authors - @see AUTHORS file. */
+
+#ifndef _AUTOTUNE_H_
+#define _AUTOTUNE_H_
+
+#include <string>
+#include <optional>
+#include <functional>
+#include <opencv2/core/mat.hpp>
+
+// Chosen mask generation configuration
+struct autotune_t {
+    // model file name (as found in models/)
+    std::string model;
+    // inference threads
+    size_t threads;
+    // XNNPACK delegate enabled
+    bool xnnpack;
+    // measured mask generation rate (frames per second, per stream)
+    double fps;
+};
+
+// Pick the most accurate model, thread count and delegate setting that
+// generates masks for <streams> frames of width x height at target_fps or
+// better, using at most max_threads. A result cached for this CPU model,
+// geometry and target is returned without measuring, otherwise candidates
+// are timed on sample (a captured frame, or synthetic if empty) and the
+// choice is cached. resolve maps a model file name to a loadable path.
+// Returns false if no model could be loaded at all.
+bool autotune(double target_fps, size_t width, size_t height, size_t streams, size_t max_threads,
+    const std::function<std::optional<std::string>(const std::string&)>& resolve,
+    const cv::Mat& sample, int debug, autotune_t& out);
+
+#endif
@@ -177,7 +177,7 @@ std::shared_ptr<background_t> load_background(const std::string& path, int debug
     return pbkd;
 }
 
-int grab_background(std::shared_ptr<background_t> pbkd, int width, int height, cv::Mat& out) {
+int grab_background(std::shared_ptr<background_t> pbkd, int width, int height, cv::Mat& out, int last) {
     if (!pbkd)
         return -1;
     // static image or video?
@@ -185,14 +185,17 @@ int grab_background(std::shared_ptr<background_t> pbkd, int width, int height, c
     if (pbkd->video) {
         // grab frame & frame no. under mutex
         std::unique_lock<std::mutex> hold(pbkd->rawmux);
+        if (pbkd->frame == last && out.cols == width && out.rows == height)
+            return last;
         cv::Rect_<int> crop = calcCropping(pbkd->raw.cols,pbkd->raw.rows,width, height);
         cv::resize(pbkd->raw(crop), out, cv::Size(width, height));
         frm = pbkd->frame;
     } else {
-        // resize still image as requested into out
+        // resize still image as requested into out (once)
+        if (1 == last && out.cols == width && out.rows == height)
+            return last;
         cv::Rect_<int> crop = calcCropping(pbkd->raw.cols, pbkd->raw.rows, width, height);
         cv::resize(pbkd->raw(crop), out, cv::Size(width, height));
-        out = pbkd->raw;
         frm = 1;
     }
     return frm;
@@ -16,7 +16,9 @@ std::shared_ptr<background_t> load_background(const std::string& path, int debug
 // Grab current frame from background
 // Returns current frame number (1 for still image) or -1 on error
 // NB: current frame can loop round to 0!
-int grab_background(std::shared_ptr<background_t> handle, int width, int height, cv::Mat &out);
+// Pass the number returned by the last grab into the same out as last to
+// leave out alone while the frame is unchanged.
+int grab_background(std::shared_ptr<background_t> handle, int width, int height, cv::Mat &out, int last = -1);
 
 // Grab current thumbnail image (if any) from background
 // Returns <0 on error, 0 on success and copies thumbnail to out
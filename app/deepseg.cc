@@ -3,26 +3,34 @@
 ==============================================================================*/
 
 #include <unistd.h>
+#include <semaphore.h>
 #include <cstdio>
 #include <chrono>
 #include <string>
 #include <thread>
-#include <mutex>
+#include <atomic>
 #include <fstream>
 #include <istream>
 #include <regex>
 #include <optional>
 #include <utility>
-#include <condition_variable>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/videoio/videoio.hpp>
 
+#include "videoio/capture.h"
 #include "videoio/loopback.h"
 #include "lib/libbackscrub.h"
 #include "background.h"
+#include "autotune.h"
+#include "triplebuf.h"
 
 // Temporary declaration of utility class until we merge experimental!
 class on_scope_exit final {
@@ -51,6 +59,13 @@ public:
 
 #define DEBUG_WIN_NAME "Backscrub " _STR(DEEPSEG_VERSION) " ('?' for help)"
 
+// longest wait for a natively captured frame, in ms
+#define CAPTURE_TIMEOUT 1000
+
+// driver buffers of a streaming virtual camera: one being rendered, one
+// being read by the consumer, one spare
+#define LOOPBACK_BUFFERS 3
+
 int fourCcFromString(const std::string& in)
 {
 	if (in.empty())
@@ -83,56 +98,6 @@ std::optional<std::pair<size_t, size_t>> geometryFromString(const std::string& i
 	return std::pair<size_t, size_t>(w, h);
 }
 
-// OpenCV helper functions
-cv::Mat convert_rgb_to_yuyv( cv::Mat input ) {
-	cv::Mat tmp;
-	cv::cvtColor(input, tmp, cv::COLOR_RGB2YUV);
-	std::vector<cv::Mat> yuv;
-	cv::split(tmp, yuv);
-	cv::Mat yuyv(tmp.rows, tmp.cols, CV_8UC2);
-	uint8_t* outdata = (uint8_t*)yuyv.data;
-	uint8_t* ydata = (uint8_t*)yuv[0].data;
-	uint8_t* udata = (uint8_t*)yuv[1].data;
-	uint8_t* vdata = (uint8_t*)yuv[2].data;
-	for (unsigned int i = 0; i < yuyv.total(); i += 2) {
-		uint8_t u = (uint8_t)(((int)udata[i]+(int)udata[i+1])/2);
-		uint8_t v = (uint8_t)(((int)vdata[i]+(int)vdata[i+1])/2);
-		outdata[2*i+0] = ydata[i+0];
-		outdata[2*i+1] = v;
-		outdata[2*i+2] = ydata[i+1];
-		outdata[2*i+3] = u;
-	}
-	return yuyv;
-}
-
-cv::Mat alpha_blend(cv::Mat srca, cv::Mat srcb, cv::Mat mask) {
-	// alpha blend two (8UC3) source images using a mask (8UC1, 255=>srca, 0=>srcb), adapted from:
-	// https://www.learnopencv.com/alpha-blending-using-opencv-cpp-python/
-	// "trust no-one" => we're about to mess with data pointers
-	assert(srca.rows == srcb.rows);
-	assert(srca.cols == srcb.cols);
-	assert(mask.rows == srca.rows);
-	assert(mask.cols == srca.cols);
-	assert(srca.type() == CV_8UC3);
-	assert(srcb.type() == CV_8UC3);
-	assert(mask.type() == CV_8UC1);
-	cv::Mat out = cv::Mat::zeros(srca.size(), srca.type());
-	uint8_t *optr = (uint8_t*)out.data;
-	uint8_t *aptr = (uint8_t*)srca.data;
-	uint8_t *bptr = (uint8_t*)srcb.data;
-	uint8_t *mptr = (uint8_t*)mask.data;
-	int npix = srca.rows * srca.cols;
-	for (int pix = 0; pix < npix; ++pix) {
-		// blending weights
-		int aw = (int)(*mptr++), bw = 255-aw;
-		// blend each channel byte
-		*optr++ = (uint8_t)(( (int)(*aptr++)*aw + (int)(*bptr++)*bw )/255);
-		*optr++ = (uint8_t)(( (int)(*aptr++)*aw + (int)(*bptr++)*bw )/255);
-		*optr++ = (uint8_t)(( (int)(*aptr++)*aw + (int)(*bptr++)*bw )/255);
-	}
-	return out;
-}
-
 // timing helpers
 typedef std::chrono::high_resolution_clock::time_point timestamp_t;
 typedef struct {
@@ -155,70 +120,143 @@ long diffnanosecs(timestamp_t t1, timestamp_t t2) {
 	return std::chrono::duration_cast<std::chrono::nanoseconds>(t1-t2).count();
 }
 
-// encapsulation of mask calculation logic and threading
+// encapsulation of mask calculation logic and threading, for one or more
+// video streams sharing a model (multiple streams are processed as a batch).
+// Frames and masks are exchanged through lock-free triple buffers of reused
+// slots, the only blocking is the processing thread sleeping between frames.
 class CalcMask final {
 protected:
-	enum class thread_state { RUNNING, DONE };
-	volatile thread_state state;
+	std::atomic<bool> running;
 	void *maskctx;
 	timestamp_t t0;
-	// buffers
-	cv::Mat mask1;
-	cv::Mat mask2;
-	cv::Mat *mask_current;
-	cv::Mat *mask_out;
-	cv::Mat frame1;
-	cv::Mat frame2;
-	cv::Mat *frame_current;
-	cv::Mat *frame_next;
-	// thread synchronisation
-	std::mutex lock_frame;
-	std::mutex lock_mask;
-	std::condition_variable condition_new_frame;
-	bool new_frame;
-	bool new_mask;
+	size_t nstreams;
+	// low resolution masks (composited by the caller) instead of full size ones
+	bool lowres;
+	// mask handed out, with the frame it was generated from
+	struct mask_slot_t {
+		cv::Mat mask;
+		bs_lowres_mask_t lmask;
+		cv::Mat key;
+	};
+	// per stream: frames in (captured straight into the slots), masks out
+	std::unique_ptr<triple_buffer_t<cv::Mat>[]> frames_in;
+	std::unique_ptr<triple_buffer_t<mask_slot_t>[]> masks_out;
+	// slot buffers, reused once nobody holds them any more (eg: key frames
+	// kept for propagation): per stream for frames, one for masks
+	std::vector<void *> frame_pools;
+	void *mask_pool;
+	// processing thread state: streams with a frame so far, current batch
+	std::vector<bool> frame_seen;
+	std::vector<cv::Mat> frames;
+	std::vector<cv::Mat> masks;
+	std::vector<bs_lowres_mask_t> lmasks;
+	// inference cadence: only every n'th input frame is processed
+	size_t cadence;
+	std::vector<size_t> frame_count;
+	// posted for each published frame
+	sem_t frame_ready;
 	std::thread thread;
+	// pipelined: the library workers process frames, no thread of our own
+	bool pipelined;
+	uint64_t seq;
+	timestamp_t tdone;
+
+	// all streams have delivered at least one frame
+	bool all_seen() {
+		return std::all_of(frame_seen.begin(), frame_seen.end(), [](bool b) { return b; });
+	}
 
 	void run() {
-		cv::Mat *raw_tmp;
 		timestamp_t tloop;
 
-		while(thread_state::RUNNING == this->state) {
+		while (running) {
 			tloop = t0 = timestamp();
 			/* actual handling */
-			{
-				std::unique_lock<std::mutex> hold(lock_frame);
-				while (!new_frame) {
-					condition_new_frame.wait(hold);
+			sem_wait(&frame_ready);
+			while (sem_trywait(&frame_ready) == 0)
+				;
+			if (!running)
+				return;
+			// latest frame of streams that published one, others reuse their last one
+			bool fresh = false;
+			for (size_t i = 0; i < nstreams; i++) {
+				if (frames_in[i].take()) {
+					frame_seen[i] = true;
+					fresh = true;
 				}
-
-				// change frame buffer pointer
-				new_frame = false;
-				raw_tmp = frame_next;
-				frame_next = frame_current;
-				frame_current = raw_tmp;
 			}
+			if (!fresh || !all_seen())
+				continue;
+			for (size_t i = 0; i < nstreams; i++)
+				frames[i] = frames_in[i].read_slot();
 			waitns = diffnanosecs(timestamp(), t0);
 			t0 = timestamp();
-			if(!bs_maskgen_process(maskctx, *frame_current, *mask_current)) {
+			bool ok = lowres ?
+				bs_maskgen_process_lowres(maskctx, frames, lmasks) :
+				nstreams > 1 ?
+				bs_maskgen_process_batch(maskctx, frames, masks) :
+				bs_maskgen_process(maskctx, frames[0], masks[0]);
+			if (!ok) {
 				fprintf(stderr, "failed to process video frame\n");
 				exit(1);
 			}
-			{
-				std::unique_lock<std::mutex> hold(lock_mask);
-				raw_tmp = mask_out;
-				mask_out = mask_current;
-				mask_current = raw_tmp;
-				new_mask = true;
+			for (size_t i = 0; i < nstreams; i++) {
+				mask_slot_t &slot = masks_out[i].write_slot();
+				if (lowres) {
+					slot.lmask = lmasks[i];
+				} else {
+					// the library renders the next mask into the same buffer
+					bs_pool_get(mask_pool, masks[i].size(), masks[i].type(), slot.mask);
+					masks[i].copyTo(slot.mask);
+					slot.key = frames[i];
+				}
+				masks_out[i].publish();
+				frames[i].release();
 			}
+			bs_maskgen_stats_t stats;
+			if (bs_maskgen_stats(maskctx, stats) && stats.frames)
+				gatehit = 100.0 * stats.skipped / stats.frames;
 			loopns = diffnanosecs(timestamp(), tloop);
 		}
 	}
 
+	// pipelined result delivery (on a library worker thread, in frame order)
+	static void ondone(void *ctx, bs_mask_result_t &result) {
+		CalcMask *cls = (CalcMask *)ctx;
+		if (!result.ok) {
+			fprintf(stderr, "failed to process video frame\n");
+			exit(1);
+		}
+		mask_slot_t &slot = cls->masks_out[0].write_slot();
+		slot.mask = result.mask;
+		slot.lmask = result.lowres;
+		slot.key = result.frame;
+		cls->masks_out[0].publish();
+		// stages run on different workers, so take their durations from the
+		// library instead of timing callbacks
+		bs_maskgen_stats_t stats;
+		if (bs_maskgen_stats(cls->maskctx, stats)) {
+			if (stats.frames)
+				cls->gatehit = 100.0 * stats.skipped / stats.frames;
+			cls->prepns = stats.prep_ns;
+			cls->dnsens = stats.denoise_ns;
+			cls->tfltns = stats.infer_ns;
+			cls->maskns = stats.post_ns;
+		}
+		// stages overlap, so they do not add up to the interval between masks
+		timestamp_t now = timestamp();
+		cls->loopns = diffnanosecs(now, cls->tdone);
+		cls->tdone = now;
+	}
+
 	// timing callbacks
 	static void onprep(void *ctx) {
 		CalcMask *cls = (CalcMask *)ctx;
 		cls->prepns = diffnanosecs(timestamp(), cls->t0);
+		// noise reduction share of preparation
+		bs_maskgen_stats_t stats;
+		if (bs_maskgen_stats(cls->maskctx, stats))
+			cls->dnsens = stats.denoise_ns;
 		cls->t0 = timestamp();
 	}
 	static void oninfer(void *ctx) {
@@ -238,50 +276,106 @@ public:
 	long tfltns;
 	long maskns;
 	long loopns;
+	long dnsens;
+	// motion gating hit rate (percent of frames that reused a mask)
+	double gatehit;
 
 	CalcMask(const std::string& modelname,
-			 size_t threads,
+			 const bs_maskgen_opts_t& opts,
 			 size_t width,
-			 size_t height) {
-		maskctx = bs_maskgen_new(modelname.c_str(), threads, width, height, nullptr, onprep, oninfer, onmask, this);
+			 size_t height,
+			 size_t streams = 1,
+			 size_t every = 1,
+			 bool low = false) {
+		// pipelining (multiple interpreters) is done by the library, for a single stream
+		pipelined = opts.interpreters > 1 && streams == 1;
+		if (pipelined)
+			maskctx = bs_maskgen_new(modelname.c_str(), opts, width, height, nullptr, nullptr, nullptr, nullptr, this);
+		else
+			maskctx = bs_maskgen_new(modelname.c_str(), opts, width, height, nullptr, onprep, oninfer, onmask, this);
 		if (!maskctx)
 			throw "Could not create mask context";
 
 		// Do all other initialization …
-		frame_next = &frame1;
-		frame_current = &frame2;
-		mask_current = &mask1;
-		mask_out = &mask2;
-		new_frame = false;
-		new_mask = false;
-		state = thread_state::RUNNING;
-		thread = std::thread(&CalcMask::run, this);
+		nstreams = streams;
+		lowres = low;
+		frames_in.reset(new triple_buffer_t<cv::Mat>[nstreams]);
+		masks_out.reset(new triple_buffer_t<mask_slot_t>[nstreams]);
+		for (size_t i = 0; i < nstreams; i++)
+			frame_pools.push_back(bs_pool_new());
+		mask_pool = bs_pool_new();
+		frame_seen.assign(nstreams, false);
+		frames.resize(nstreams);
+		masks.resize(nstreams);
+		lmasks.resize(nstreams);
+		cadence = std::max((size_t)1, every);
+		frame_count.assign(nstreams, 0);
+		sem_init(&frame_ready, 0, 0);
+		waitns = prepns = tfltns = maskns = loopns = dnsens = 0;
+		gatehit = 0;
+		seq = 0;
+		tdone = timestamp();
+		running = true;
+		if (pipelined)
+			bs_maskgen_async(maskctx, opts.interpreters + 1, lowres, ondone);
+		else
+			thread = std::thread(&CalcMask::run, this);
 	}
 
 	~CalcMask() {
-		// mark as done
-		state = thread_state::DONE;
-		// wake up processing thread
-		new_frame = true;
-		condition_new_frame.notify_all();
+		// mark as done & wake up processing thread
+		running = false;
+		sem_post(&frame_ready);
 		// collect termination
-		thread.join();
+		if (thread.joinable())
+			thread.join();
 		bs_maskgen_delete(maskctx);
+		sem_destroy(&frame_ready);
+		for (void *pool : frame_pools)
+			bs_pool_delete(pool);
+		bs_pool_delete(mask_pool);
 	}
 
-	void set_input_frame(cv::Mat &frame) {
-		std::lock_guard<std::mutex> hold(lock_frame);
-		*frame_next = frame.clone();
-		new_frame = true;
-		condition_new_frame.notify_all();
+	// slot (8UC3, of the expected frame size) to capture the next frame of
+	// a stream into, it must not be modified once handed over with set_input_frame
+	cv::Mat &input_slot(cv::Size size, size_t stream = 0) {
+		cv::Mat &slot = frames_in[stream].write_slot();
+		bs_pool_get(frame_pools[stream], size, CV_8UC3, slot);
+		return slot;
 	}
 
-	void get_output_mask(cv::Mat &out) {
-		if (new_mask) {
-			std::lock_guard<std::mutex> hold(lock_mask);
-			out = mask_out->clone();
-			new_mask = false;
+	void set_input_frame(size_t stream = 0) {
+		if (frame_count[stream]++ % cadence)
+			return;
+		if (pipelined) {
+			// dropped while all interpreters are busy
+			bs_maskgen_submit(maskctx, frames_in[stream].write_slot(), seq++);
+			frames_in[stream].publish();
+			return;
 		}
+		frames_in[stream].publish();
+		sem_post(&frame_ready);
+	}
+
+	// returns true if out was updated, key (if given) receives the frame it belongs to
+	bool get_output_mask(cv::Mat &out, size_t stream = 0, cv::Mat *key = nullptr) {
+		if (!masks_out[stream].take())
+			return false;
+		mask_slot_t &slot = masks_out[stream].read_slot();
+		out = slot.mask;
+		if (key)
+			*key = slot.key;
+		// only the caller holds on to the key frame
+		slot.key.release();
+		return true;
+	}
+
+	// low resolution variant, only valid when constructed for low resolution masks
+	bool get_output_lowres(bs_lowres_mask_t &out, size_t stream = 0) {
+		if (!masks_out[stream].take())
+			return false;
+		out = masks_out[stream].read_slot().lmask;
+		return true;
 	}
 };
 
@@ -346,13 +440,462 @@ std::optional<std::string> resolve_path(const std::string& provided, const std::
 	return {};
 }
 
+// Settings shared by all capture -> virtual camera pipelines
+struct settings_t {
+	int debug = 0;
+	bool flipHorizontal = false;
+	bool flipVertical = false;
+	int fourcc = 0;
+	size_t blur_strength = 0;
+	// warp masks onto frames with optical flow
+	bool propagate = false;
+	// Y'CbCr matrix and pixel format of the virtual camera output
+	bs_yuv_matrix_t yuv_matrix = bs_yuv_matrix_t::BT601;
+	bs_pixfmt_t pixfmt = bs_pixfmt_t::YUYV;
+	// native capture driver buffers (0: capture through OpenCV)
+	size_t capbufs = 0;
+	// worker pool for row band parallel stages (shared by all pipelines),
+	// and the number of bands a frame is split into
+	void *workers = nullptr;
+	size_t bands = 1;
+	std::optional<std::pair<size_t, size_t>> capGeo = {};
+	std::optional<std::pair<size_t, size_t>> vidGeo = {};
+};
+
+// One capture -> virtual camera pipeline
+struct pipeline_t {
+	// as specified (command line or config file)
+	std::string ccam;
+	std::string vcam;
+	std::string back;
+	std::string model;
+	// model not given explicitly (eligible for autotuning)
+	bool default_model = false;
+	// resolved model path
+	std::optional<std::string> s_model;
+	// capture device (OpenCV or native) and true geometry
+	cv::VideoCapture cap;
+	void *vcap = nullptr;
+	std::optional<std::pair<size_t, size_t>> capGeo = {};
+	std::optional<std::pair<size_t, size_t>> vidGeo = {};
+	cv::Rect_<int> crop_region = cv::Rect_<int>(0, 0, 0, 0);
+	// virtual camera, and its mapped buffers when streaming
+	int lbfd = -1;
+	void *lbstream = nullptr;
+	// capture time of the current frame, stamped on the output buffer
+	struct timespec grabts = {};
+	// processing components, all at capture true geometry
+	std::shared_ptr<background_t> pbk;
+	cv::Mat bg;
+	// background frame number in bg (see grab_background)
+	int bgframe = -1;
+	cv::Mat mask;
+	// captured frame (shared with mask generation, read-only), capture
+	// buffer when cropping, output frame (a view of the driver buffer when
+	// streaming, see output_frame), all reused from frame to frame
+	cv::Mat raw;
+	cv::Mat capbuf;
+	cv::Mat bgblur;
+	cv::Mat out;
+	// output compositor
+	void *compose = nullptr;
+	// mask generation, possibly shared with other pipelines using the same model
+	CalcMask *ai = nullptr;
+	size_t ai_stream = 0;
+	// optional mask propagation between inferred frames
+	void *prop = nullptr;
+	cv::Mat key;
+	cv::Mat pmask;
+	// low resolution mask, when composited directly (no propagation)
+	bs_lowres_mask_t lmask;
+	timinginfo_t ti;
+
+	~pipeline_t() {
+		capture_close(vcap);
+		loopback_stream_delete(lbstream);
+		if (lbfd >= 0)
+			loopback_free(lbfd);
+		bs_propagate_delete(prop);
+		bs_compose_delete(compose);
+	}
+};
+
+// Read a multi-stream configuration file, one pipeline per line:
+//   <capture> <virtual> [<background>] [<model>]
+// '#' starts a comment, '-' or an omitted column takes the command line value.
+static bool read_config(const std::string& path, const pipeline_t& defaults, std::vector<std::unique_ptr<pipeline_t>>& out) {
+	std::ifstream cfg(path);
+	if (!cfg.good()) {
+		fprintf(stderr, "Error: unable to read config file: %s\n", path.c_str());
+		return false;
+	}
+	std::string line;
+	for (int lineno = 1; std::getline(cfg, line); lineno++) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream cols(line);
+		std::vector<std::string> col;
+		for (std::string c; cols >> c; )
+			col.push_back(c);
+		if (col.empty())
+			continue;
+		if (col.size() < 2 || col.size() > 4) {
+			fprintf(stderr, "Error: %s:%d: expected <capture> <virtual> [<background>] [<model>]\n", path.c_str(), lineno);
+			return false;
+		}
+		auto p = std::make_unique<pipeline_t>();
+		p->ccam = col[0];
+		p->vcam = col[1];
+		p->back = col.size() > 2 && col[2] != "-" ? col[2] : defaults.back;
+		p->default_model = !(col.size() > 3 && col[3] != "-");
+		p->model = p->default_model ? defaults.model : col[3];
+		out.push_back(std::move(p));
+	}
+	if (out.empty()) {
+		fprintf(stderr, "Error: no pipelines in config file: %s\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+static uint32_t v4l2_pixfmt(bs_pixfmt_t format) {
+	switch (format) {
+	case bs_pixfmt_t::NV12:
+		return V4L2_PIX_FMT_NV12;
+	case bs_pixfmt_t::I420:
+		return V4L2_PIX_FMT_YUV420;
+	case bs_pixfmt_t::RGB24:
+		return V4L2_PIX_FMT_RGB24;
+	default:
+		return V4L2_PIX_FMT_YUYV;
+	}
+}
+
+// Output frame of the given format as a matrix OpenCV can convert for
+// display: packed formats pixel by pixel, 4:2:0 as all planes stacked in
+// one channel. Over data (rows stride bytes apart) if given, else allocated.
+static cv::Mat output_frame(bs_pixfmt_t format, cv::Size size, uint8_t *data = nullptr, size_t stride = 0) {
+	int rows = size.height, type = CV_8UC2;
+	if (bs_pixfmt_t::NV12 == format || bs_pixfmt_t::I420 == format) {
+		rows = size.height * 3 / 2;
+		type = CV_8UC1;
+	} else if (bs_pixfmt_t::RGB24 == format) {
+		type = CV_8UC3;
+	}
+	if (data)
+		return cv::Mat(rows, size.width, type, data, stride);
+	return cv::Mat(rows, size.width, type);
+}
+
+// Open devices and resolve geometry for a pipeline. Backgrounds are shared
+// between pipelines using the same source.
+static bool open_pipeline(pipeline_t& p, const settings_t& s,
+	std::map<std::string, std::shared_ptr<background_t>>& backgrounds) {
+	std::string s_ccam(p.ccam);
+	std::string s_vcam(p.vcam);
+	// permit unprefixed device names (a raw frame file may stand in for the
+	// capture device)
+	if (s_ccam.rfind("/dev/", 0) != 0 && access(s_ccam.c_str(), F_OK) != 0)
+		s_ccam = "/dev/" + s_ccam;
+	if (s_vcam.rfind("/dev/", 0) != 0)
+		s_vcam = "/dev/" + s_vcam;
+	p.s_model = resolve_path(p.model, "models");
+	std::optional<std::string> s_backg = !p.back.empty() ? resolve_path(p.back, "backgrounds") : std::nullopt;
+	// open capture early to resolve true geometry
+	p.capGeo = s.capGeo;
+	p.vidGeo = s.vidGeo;
+	std::optional<std::pair<size_t, size_t>> tmpGeo;
+	if (s.capbufs) {
+		int w = (int)p.capGeo.value().first, h = (int)p.capGeo.value().second;
+		p.vcap = capture_open(s_ccam, w, h, V4L2_PIX_FMT_YUYV, s.capbufs, s.debug);
+		if (!p.vcap) {
+			fprintf(stderr, "failed to open capture device\n");
+			return false;
+		}
+		tmpGeo = std::pair<size_t, size_t>(w, h);
+	} else {
+		p.cap.open(s_ccam.c_str(), cv::CAP_V4L2);
+		if(!p.cap.isOpened()) {
+			perror("failed to open capture device");
+			return false;
+		}
+		// set fourcc (if specified) /before/ attempting to set geometry (@see issue146)
+		if (s.fourcc)
+			p.cap.set(cv::CAP_PROP_FOURCC, s.fourcc);
+		p.cap.set(cv::CAP_PROP_FRAME_WIDTH,  p.capGeo.value().first);
+		p.cap.set(cv::CAP_PROP_FRAME_HEIGHT, p.capGeo.value().second);
+		p.cap.set(cv::CAP_PROP_CONVERT_RGB, true);
+		tmpGeo = std::pair<size_t, size_t>(
+			(size_t)p.cap.get(cv::CAP_PROP_FRAME_WIDTH),
+			(size_t)p.cap.get(cv::CAP_PROP_FRAME_HEIGHT)
+		);
+	}
+	if (tmpGeo != p.capGeo) {
+		fprintf(stderr, "Warning: capture device geometry changed from requested values.\n");
+		p.capGeo = tmpGeo;
+	}
+	if (!p.vidGeo) {
+		p.vidGeo = p.capGeo;
+	}
+	if (bs_pixfmt_t::RGB24 != s.pixfmt && (p.vidGeo.value().first & 1)) {
+		fprintf(stderr, "Error: virtual camera width must be even (Y'CbCr).\n");
+		return false;
+	}
+	if ((bs_pixfmt_t::NV12 == s.pixfmt || bs_pixfmt_t::I420 == s.pixfmt) && (p.vidGeo.value().second & 1)) {
+		fprintf(stderr, "Error: virtual camera height must be even (4:2:0).\n");
+		return false;
+	}
+	// aspect ratio changed? warn
+	// NB: we calculate this way round to avoid comparing doubles..
+	size_t expWidth = (size_t)((double)p.vidGeo.value().second * (double)p.capGeo.value().first/(double)p.capGeo.value().second);
+	if (expWidth != p.vidGeo.value().first) {
+		fprintf(stderr, "Warning: virtual camera aspect ratio does not match capture device.\n");
+	}
+	// calculate crop region, only if result always smaller
+	if (expWidth != p.vidGeo.value().first &&
+		p.vidGeo.value().first <= p.capGeo.value().first &&
+		p.vidGeo.value().second <= p.capGeo.value().second) {
+			p.crop_region = calcCropping(
+				p.capGeo.value().first, p.capGeo.value().second,
+				p.vidGeo.value().first, p.vidGeo.value().second);
+	}
+
+	// dump settings..
+	printf("debug:  %d\n", s.debug);
+	printf("ccam:   %s\n", s_ccam.c_str());
+	printf("vcam:   %s\n", s_vcam.c_str());
+	printf("capGeo: %zux%zu\n", p.capGeo.value().first, p.capGeo.value().second);
+	printf("vidGeo: %zux%zu\n", p.vidGeo.value().first, p.vidGeo.value().second);
+	printf("flip_h: %s\n", s.flipHorizontal ? "yes" : "no");
+	printf("flip_v: %s\n", s.flipVertical ? "yes" : "no");
+	printf("back:   %s => %s\n", !p.back.empty() ? p.back.c_str() : "(none)", s_backg ? s_backg.value().c_str() : "(none)");
+	printf("model:  %s => %s\n\n", p.model.c_str(), p.s_model ? p.s_model.value().c_str() : "(none)");
+
+	// No model - stop here
+	if (!p.s_model) {
+		printf("Error: unable to load specified model: %s\n", p.model.c_str());
+		return false;
+	}
+
+	// Load background if specified
+	if (s_backg) {
+		auto it = backgrounds.find(s_backg.value());
+		if (it == backgrounds.end())
+			it = backgrounds.emplace(s_backg.value(), load_background(s_backg.value(), s.debug)).first;
+		p.pbk = it->second;
+		if (!p.pbk)
+			printf("Warning: could not load background image, defaulting to green\n");
+	}
+	// processing geometry: capture true geometry or crop region
+	int aiw = p.crop_region.height ? p.crop_region.width : (int)p.capGeo.value().first;
+	int aih = p.crop_region.height ? p.crop_region.height : (int)p.capGeo.value().second;
+	// default green screen background
+	p.bg = cv::Mat(aih, aiw, CV_8UC3, cv::Scalar(0, 255, 0));
+
+	// Virtual camera (at specified geometry)
+	p.lbfd = loopback_init(s_vcam, p.vidGeo.value().first, p.vidGeo.value().second, s.debug,
+		bs_yuv_matrix_t::BT709 == s.yuv_matrix, v4l2_pixfmt(s.pixfmt));
+	if(p.lbfd < 0) {
+		fprintf(stderr, "Failed to initialize vcam device.\n");
+		return false;
+	}
+	// render into driver buffers if possible, else write() every frame
+	p.lbstream = loopback_stream_new(p.lbfd, LOOPBACK_BUFFERS, s.debug);
+
+	p.mask = cv::Mat(aih, aiw, CV_8U);
+	p.compose = bs_compose_new(s.workers);
+	if (s.propagate)
+		p.prop = bs_propagate_new(aiw, aih);
+	return true;
+}
+
+// Gaussian blur in row bands on the worker pool. Each band reads the rows
+// around it from the whole frame, so the result equals a single call.
+static void blur_bands(const settings_t& s, const cv::Mat& src, cv::Mat& dst) {
+	dst.create(src.size(), src.type());
+	const size_t bands = std::min(s.bands, (size_t)src.rows);
+	bs_workers_run(s.workers, bands, [&](size_t b) {
+		int y0 = (int)(src.rows * b / bands), y1 = (int)(src.rows * (b + 1) / bands);
+		cv::Mat band = dst.rowRange(y0, y1);
+		cv::GaussianBlur(src.rowRange(y0, y1), band, cv::Size(s.blur_strength, s.blur_strength), 0);
+	});
+}
+
+// Grab the newest frame of a native capture and convert it from the driver
+// buffer into frame (BGR, cropped if need be)
+static bool grab_native(pipeline_t& p, cv::Mat& frame) {
+	capture_frame_t f;
+	if (!capture_grab(p.vcap, f, CAPTURE_TIMEOUT))
+		return false;
+	p.ti.grabns = timestamp();
+	p.grabts = f.ts;
+	cv::Mat yuyv(f.height, f.width, CV_8UC2, (void *)f.data, f.stride);
+	if (p.crop_region.height) {
+		cv::cvtColor(yuyv, p.capbuf, cv::COLOR_YUV2BGR_YUYV);
+		p.capbuf((cv::Rect_<int>)p.crop_region).copyTo(frame);
+	} else {
+		cv::cvtColor(yuyv, frame, cv::COLOR_YUV2BGR_YUYV);
+	}
+	capture_release(p.vcap, f);
+	p.ti.retrns = timestamp();
+	return true;
+}
+
+// Run one iteration of a pipeline: capture, composite and write a frame.
+// Returns false if no usable frame was captured.
+static bool step_pipeline(pipeline_t& p, const settings_t& s, bool filterActive) {
+	// grab new frame from cam (natively: once there is a slot to convert to)
+	if (!p.vcap) {
+		p.cap.grab();
+		p.ti.grabns = timestamp();
+		clock_gettime(CLOCK_MONOTONIC, &p.grabts);
+	}
+	// retrieve it straight into the frame slot of mask generation (through
+	// the capture buffer when cropping), letting go of the last one first
+	p.raw.release();
+	cv::Size fsize = p.crop_region.height ? p.crop_region.size() :
+		cv::Size((int)p.capGeo.value().first, (int)p.capGeo.value().second);
+	cv::Mat &frame = p.ai->input_slot(fsize, p.ai_stream);
+	if (p.vcap) {
+		if (!grab_native(p, frame))
+			return false;
+	} else if (p.crop_region.height) {
+		p.cap.retrieve(p.capbuf);
+		p.ti.retrns = timestamp();
+		if (p.capbuf.rows == 0 || p.capbuf.cols == 0) return false; // sanity check
+		p.capbuf((cv::Rect_<int>)p.crop_region).copyTo(frame);
+	} else {
+		p.cap.retrieve(frame);
+		p.ti.retrns = timestamp();
+	}
+	p.ti.copyns = timestamp();
+
+	if (frame.rows == 0 || frame.cols == 0) return false; // sanity check
+
+	// from here on the frame is only read, output goes to p.out
+	p.raw = frame;
+	p.ai->set_input_frame(p.ai_stream);
+	// blend, flip, scale and convert in one pass, stripe by stripe
+	bs_output_t output;
+	output.size = cv::Size((int)p.vidGeo.value().first, (int)p.vidGeo.value().second);
+	output.flip_h = s.flipHorizontal;
+	output.flip_v = s.flipVertical;
+	output.format = s.pixfmt;
+	output.matrix = s.yuv_matrix;
+	loopback_buf_t buf;
+	if (p.lbstream) {
+		if (!loopback_dequeue(p.lbstream, buf))
+			throw "Failed to get an output buffer";
+		p.out = output_frame(output.format, output.size, buf.data, buf.stride);
+	} else if (p.out.empty()) {
+		p.out = output_frame(output.format, output.size);
+	}
+
+	if (filterActive) {
+		// do background detection magic
+		// - with propagation: full size mask carried along to this frame
+		// - otherwise: low resolution mask, evaluated while blending
+		cv::Mat mask = p.mask;
+		if (p.prop) {
+			if (p.ai->get_output_mask(p.mask, p.ai_stream, &p.key))
+				bs_propagate_key(p.prop, p.key, p.mask);
+			if (bs_propagate(p.prop, p.raw, p.pmask))
+				mask = p.pmask;
+		} else {
+			p.ai->get_output_lowres(p.lmask, p.ai_stream);
+			// full size mask only for the debug view
+			if (s.debug > 1)
+				bs_lowres_render(p.lmask, p.raw, p.mask);
+		}
+
+		// get background frame:
+		// - specified source if set
+		// - input video if blur_strength != 0
+		// - default green (initial value)
+		// blurred (unless it's just green) into a separate buffer if requested
+		// (resized and blurred again only when the background changed)
+		cv::Mat bg = p.bg;
+		if (p.pbk) {
+			int bgframe = grab_background(p.pbk, p.raw.cols, p.raw.rows, p.bg, p.bgframe);
+			if (bgframe < 0)
+				throw "Failed to read background frame";
+			bg = p.bg;
+			if (s.blur_strength) {
+				if (bgframe != p.bgframe || p.bgblur.size() != p.bg.size())
+					blur_bands(s, p.bg, p.bgblur);
+				bg = p.bgblur;
+			}
+			p.bgframe = bgframe;
+		} else if (s.blur_strength) {
+			blur_bands(s, p.raw, p.bgblur);
+			bg = p.bgblur;
+		}
+		p.ti.prepns = timestamp();
+		// alpha blend background over foreground using mask
+		bs_compose(p.compose, output, p.prop ? &mask : nullptr, p.prop ? nullptr : &p.lmask,
+			bg, p.raw, p.out.data, p.out.step[0]);
+	} else {
+		p.ti.prepns = timestamp();
+		bs_compose(p.compose, output, nullptr, nullptr, p.raw, p.raw, p.out.data, p.out.step[0]);
+	}
+	// flipping and scaling are part of the composite
+	p.ti.maskns = timestamp();
+	p.ti.postns = p.ti.maskns;
+
+	// hand the frame to v4l2loopback
+	if (p.lbstream) {
+		if (!loopback_queue(p.lbstream, buf, &p.grabts))
+			throw "Failed to queue output buffer";
+	} else {
+		const uint8_t *data = p.out.data;
+		size_t framesize = bs_output_bytes(output.format, output.size.height, p.out.step[0]);
+		while (framesize > 0) {
+			ssize_t ret = write(p.lbfd, data, framesize);
+			if(ret <= 0) {
+				perror("writing to loopback device");
+				exit(1);
+			}
+			data += ret;
+			framesize -= ret;
+		}
+	}
+	p.ti.v4l2ns = timestamp();
+	return true;
+}
+
+// Pipeline thread for multi-stream (daemon) mode, reports once a second when debugging
+static void run_pipeline(pipeline_t *p, const settings_t *s, size_t idx, bool showProgress) try {
+	long frames = 0;
+	p->ti.lastns = timestamp();
+	for (;;) {
+		if (!step_pipeline(*p, *s, true))
+			continue;
+		if (!s->debug) {
+			if (showProgress) {
+				printf(".");
+				fflush(stdout);
+			}
+			continue;
+		}
+		frames++;
+		long ns = diffnanosecs(p->ti.v4l2ns, p->ti.lastns);
+		if (ns >= 1000000000L) {
+			printf("[%zu] %s -> %s: main FPS: %5.2f ai FPS: %5.2f gate: %3.0f%% dropped: %lu\n", idx, p->ccam.c_str(), p->vcam.c_str(),
+				1e9*frames/ns, p->ai->loopns ? 1e9/p->ai->loopns : 0.0, p->ai->gatehit, (unsigned long)capture_dropped(p->vcap));
+			frames = 0;
+			p->ti.lastns = timestamp();
+		}
+	}
+} catch(const char* msg) {
+	fprintf(stderr, "Error: [%zu] %s\n", idx, msg);
+	exit(1);
+}
+
 int main(int argc, char* argv[]) try {
 
 	printf("%s version %s (Tensorflow: build %s, run-time %s)\n", argv[0], _STR(DEEPSEG_VERSION), _STR(TF_VERSION), bs_tensorflow_version());
 	printf("(c) 2021 by floe@butterbrot.org & contributors\n");
 	printf("https://github.com/floe/backscrub\n");
-	timinginfo_t ti;
-	ti.bootns = timestamp();
+	timestamp_t bootns = timestamp();
 	int debug = 0;
 	bool showProgress = false;
 	bool showBackground = true;
@@ -372,7 +915,17 @@ int main(int argc, char* argv[]) try {
 	bool flipVertical = false;
 	int fourcc = 0;
 	size_t blur_strength = 0;
-	cv::Rect_<int> crop_region(0, 0, 0, 0);
+	const char *config = nullptr;
+	double autotune_fps = 0;
+	float motion_gate = 0.5;
+	size_t motion_max_skip = 10;
+	size_t roi_redetect = 0;
+	size_t flow_cadence = 0;
+	bs_denoise_t denoise = bs_denoise_t::Bilateral;
+	size_t interpreters = 1;
+	bs_yuv_matrix_t yuv_matrix = bs_yuv_matrix_t::BT601;
+	bs_pixfmt_t pixfmt = bs_pixfmt_t::YUYV;
+	size_t capbufs = 0;
 
 	const char* modelname = "selfiesegmentation_mlkit-256x256-2021_01_19-v1215.f16.tflite";
 
@@ -481,6 +1034,113 @@ int main(int argc, char* argv[]) try {
 			} else {
 				showUsage = true;
 			}
+		} else if (strncmp(argv[arg], "--config", 8) == 0) {
+			if (hasArgument) {
+				config = argv[++arg];
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--gate", 6) == 0) {
+			if (hasArgument && sscanf(argv[++arg], "%f:%zu", &motion_gate, &motion_max_skip) >= 1) {
+				if (motion_gate < 0 || motion_gate > 100 || !motion_max_skip) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--denoise", 9) == 0) {
+			if (hasArgument) {
+				std::string mode = argv[++arg];
+				if (mode == "none") {
+					denoise = bs_denoise_t::None;
+				} else if (mode == "gaussian") {
+					denoise = bs_denoise_t::Gaussian;
+				} else if (mode == "fastbilateral") {
+					denoise = bs_denoise_t::FastBilateral;
+				} else if (mode == "temporal") {
+					denoise = bs_denoise_t::Temporal;
+				} else if (mode == "bilateral") {
+					denoise = bs_denoise_t::Bilateral;
+				} else {
+					fprintf(stderr, "Unknown denoise mode: %s\n", mode.c_str());
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--pipeline", 10) == 0) {
+			if (hasArgument && sscanf(argv[++arg], "%zu", &interpreters)) {
+				if (!interpreters) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--yuv", 5) == 0) {
+			if (hasArgument) {
+				std::string matrix = argv[++arg];
+				if (matrix == "bt601") {
+					yuv_matrix = bs_yuv_matrix_t::BT601;
+				} else if (matrix == "bt709") {
+					yuv_matrix = bs_yuv_matrix_t::BT709;
+				} else {
+					fprintf(stderr, "Unknown YUV matrix: %s\n", matrix.c_str());
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--capture", 9) == 0) {
+			if (hasArgument && sscanf(argv[++arg], "%zu", &capbufs)) {
+				if (!capbufs) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--format", 8) == 0) {
+			if (hasArgument) {
+				static const std::map<std::string, bs_pixfmt_t> formats = {
+					{ "yuyv", bs_pixfmt_t::YUYV },
+					{ "nv12", bs_pixfmt_t::NV12 },
+					{ "i420", bs_pixfmt_t::I420 },
+					{ "rgb24", bs_pixfmt_t::RGB24 },
+				};
+				std::string format = argv[++arg];
+				auto it = formats.find(format);
+				if (it != formats.end()) {
+					pixfmt = it->second;
+				} else {
+					fprintf(stderr, "Unknown pixel format: %s\n", format.c_str());
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--flow", 6) == 0) {
+			if (hasArgument && sscanf(argv[++arg], "%zu", &flow_cadence)) {
+				if (!flow_cadence) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--roi", 5) == 0) {
+			if (hasArgument && sscanf(argv[++arg], "%zu", &roi_redetect)) {
+				if (!roi_redetect) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
+		} else if (strncmp(argv[arg], "--autotune", 10) == 0) {
+			if (hasArgument && sscanf(argv[++arg], "%lf", &autotune_fps)) {
+				if (autotune_fps <= 0) {
+					showUsage = true;
+				}
+			} else {
+				showUsage = true;
+			}
 		} else if (strncmp(argv[arg], "-t", 2) == 0) {
 			if (hasArgument && sscanf(argv[++arg], "%zu", &threads)) {
 				if (!threads) {
@@ -508,6 +1168,9 @@ int main(int argc, char* argv[]) try {
 		fprintf(stderr, "usage:\n");
 		fprintf(stderr, "  backscrub [-?] [-d] [-p] [-c <capture>] [-v <virtual>] [--cg <width>x<height>]\n");
 		fprintf(stderr, "    [--vg <width>x<height>] [-t <threads>] [-b <background>] [-m <modell>] [-p <option:value>]\n");
+		fprintf(stderr, "    [--config <file>] [--autotune <fps>] [--gate <percent>[:<frames>]] [--roi <frames>]\n");
+		fprintf(stderr, "    [--flow <n>] [--denoise <mode>] [--pipeline <n>] [--yuv <matrix>] [--format <pixfmt>]\n");
+		fprintf(stderr, "    [--capture <n>]\n");
 		fprintf(stderr, "\n");
 		fprintf(stderr, "-?            Display this usage information\n");
 		fprintf(stderr, "-d            Increase debug level\n");
@@ -528,207 +1191,175 @@ int main(int argc, char* argv[]) try {
 		fprintf(stderr, "-p bgblur:<strength>   Blur the video background\n");
 		fprintf(stderr, "-H            Mirror the output horizontally\n");
 		fprintf(stderr, "-V            Mirror the output vertically\n");
+		fprintf(stderr, "--config      Run all capture/virtual camera pipelines listed in <file>, one per line as\n");
+		fprintf(stderr, "                <capture> <virtual> [<background>|-] [<model>|-]\n");
+		fprintf(stderr, "              '-' or omitted columns take the -b/-m values, -t is shared by all models\n");
+		fprintf(stderr, "--autotune    Choose the most accurate model, threads (up to -t) and delegate setting that\n");
+		fprintf(stderr, "              reaches <fps>, instead of -m. Results are cached per CPU and geometry.\n");
+		fprintf(stderr, "--gate        Reuse the last mask while less than <percent> of the scene changed (default 0.5,\n");
+		fprintf(stderr, "              0 disables), for at most <frames> frames in a row (default 10)\n");
+		fprintf(stderr, "--roi         Track the person and segment a tight crop around them, looking at the\n");
+		fprintf(stderr, "              whole frame again every <frames> inferences (e.g. 30)\n");
+		fprintf(stderr, "--flow        Warp masks onto newer frames with optical flow and only segment every\n");
+		fprintf(stderr, "              <n>th frame (1 segments all frames, but still hides inference lag)\n");
+		fprintf(stderr, "--denoise     Noise reduction before segmentation: none, gaussian, fastbilateral,\n");
+		fprintf(stderr, "              temporal or bilateral (default)\n");
+		fprintf(stderr, "--pipeline    Segment with <n> model instances (sharing the -t threads) so preparing the\n");
+		fprintf(stderr, "              next and finishing the previous frame overlap inference (single camera)\n");
+		fprintf(stderr, "--yuv         Virtual camera colour matrix: bt601 (default) or bt709\n");
+		fprintf(stderr, "--format      Virtual camera pixel format: yuyv (default), nv12, i420 or rgb24\n");
+		fprintf(stderr, "--capture     Capture YUYV straight from <n> mapped driver buffers instead of through\n");
+		fprintf(stderr, "              OpenCV, fewer buffers mean less latency (-c may name a raw YUYV file\n");
+		fprintf(stderr, "              of --cg geometry to stand in for the camera)\n");
 		exit(1);
 	}
 
-	std::string s_ccam(ccam);
-	std::string s_vcam(vcam);
-	// permit unprefixed device names
-	if (s_ccam.rfind("/dev/", 0) != 0)
-		s_ccam = "/dev/" + s_ccam;
-	if (s_vcam.rfind("/dev/", 0) != 0)
-		s_vcam = "/dev/" + s_vcam;
-	std::optional<std::string> s_model = resolve_path(modelname, "models");
-	std::optional<std::string> s_backg = back ? resolve_path(back, "backgrounds") : std::nullopt;
-	// open capture early to resolve true geometry
-	cv::VideoCapture cap(s_ccam.c_str(), cv::CAP_V4L2);
-	if(!cap.isOpened()) {
-		perror("failed to open capture device");
-		exit(1);
-	}
-	// set fourcc (if specified) /before/ attempting to set geometry (@see issue146)
-	if (fourcc)
-		cap.set(cv::CAP_PROP_FOURCC, fourcc);
-	cap.set(cv::CAP_PROP_FRAME_WIDTH,  capGeo.value().first);
-	cap.set(cv::CAP_PROP_FRAME_HEIGHT, capGeo.value().second);
-	cap.set(cv::CAP_PROP_CONVERT_RGB, true);
-	std::optional<std::pair<size_t, size_t>> tmpGeo = std::pair<size_t, size_t>(
-		(size_t)cap.get(cv::CAP_PROP_FRAME_WIDTH),
-		(size_t)cap.get(cv::CAP_PROP_FRAME_HEIGHT)
-	);
-	if (tmpGeo != capGeo) {
-		fprintf(stderr, "Warning: capture device geometry changed from requested values.\n");
-		capGeo = tmpGeo;
-	}
-	if (!vidGeo) {
-		vidGeo = capGeo;
-	}
-	// aspect ratio changed? warn
-	// NB: we calculate this way round to avoid comparing doubles..
-	size_t expWidth = (size_t)((double)vidGeo.value().second * (double)capGeo.value().first/(double)capGeo.value().second);
-	if (expWidth != vidGeo.value().first) {
-		fprintf(stderr, "Warning: virtual camera aspect ratio does not match capture device.\n");
-	}
-	// calculate crop region, only if result always smaller
-	if (expWidth != vidGeo.value().first &&
-		vidGeo.value().first <= capGeo.value().first &&
-		vidGeo.value().second <= capGeo.value().second) {
-			crop_region = calcCropping(
-				capGeo.value().first, capGeo.value().second,
-				vidGeo.value().first, vidGeo.value().second);
-	}
-
-	// dump settings..
-	printf("debug:  %d\n", debug);
-	printf("ccam:   %s\n", s_ccam.c_str());
-	printf("vcam:   %s\n", s_vcam.c_str());
-	printf("capGeo: %zux%zu\n", capGeo.value().first, capGeo.value().second);
-	printf("vidGeo: %zux%zu\n", vidGeo.value().first, vidGeo.value().second);
-	printf("flip_h: %s\n", flipHorizontal ? "yes" : "no");
-	printf("flip_v: %s\n", flipVertical ? "yes" : "no");
-	printf("threads:%zu\n", threads);
-	printf("back:   %s => %s\n", back ? back : "(none)", s_backg ? s_backg.value().c_str() : "(none)");
-	printf("model:  %s => %s\n\n", modelname ? modelname : "(none)", s_model ? s_model.value().c_str() : "(none)");
+	settings_t settings;
+	settings.debug = debug;
+	settings.flipHorizontal = flipHorizontal;
+	settings.flipVertical = flipVertical;
+	settings.fourcc = fourcc;
+	settings.blur_strength = blur_strength;
+	settings.propagate = flow_cadence > 0;
+	settings.yuv_matrix = yuv_matrix;
+	settings.pixfmt = pixfmt;
+	settings.capbufs = capbufs;
+	// the main loop thread runs bands too, a few more bands than threads
+	// balance uneven ones
+	settings.workers = bs_workers_new(threads - 1);
+	settings.bands = 2 * threads;
+	on_scope_exit free_workers([&]() { bs_workers_delete(settings.workers); });
+	settings.capGeo = capGeo;
+	settings.vidGeo = vidGeo;
 
-	// No model - stop here
-	if (!s_model) {
-		printf("Error: unable to load specified model: %s\n", modelname);
-		exit(1);
+	// capture -> virtual camera pipelines, from the command line or a config file
+	std::vector<std::unique_ptr<pipeline_t>> pipelines;
+	pipeline_t defaults;
+	defaults.ccam = ccam;
+	defaults.vcam = vcam;
+	defaults.back = back ? back : "";
+	defaults.model = modelname;
+	if (config) {
+		if (!read_config(config, defaults, pipelines))
+			exit(1);
+	} else {
+		pipelines.push_back(std::make_unique<pipeline_t>());
+		pipelines.back()->ccam = defaults.ccam;
+		pipelines.back()->vcam = defaults.vcam;
+		pipelines.back()->back = defaults.back;
+		pipelines.back()->model = defaults.model;
+		pipelines.back()->default_model = true;
+	}
+	std::map<std::string, std::shared_ptr<background_t>> backgrounds;
+	for (auto &p : pipelines) {
+		if (!open_pipeline(*p, settings, backgrounds))
+			exit(1);
 	}
 
 	// Create debug window early (ensures highgui is correctly initialised on this thread)
-	if (debug > 1) {
+	if (debug > 1 && pipelines.size() == 1) {
 		cv::namedWindow(DEBUG_WIN_NAME, cv::WINDOW_AUTOSIZE | cv::WINDOW_GUI_EXPANDED);
 	}
 
-	// Load background if specified
-	auto pbk(s_backg ? load_background(s_backg.value(), debug) : nullptr);
-	if (!pbk) {
-		if (s_backg) {
-			printf("Warning: could not load background image, defaulting to green\n");
+	// Replace the default model with the autotuned choice, the tuned model
+	// gets its share of the thread budget to measure with.
+	std::optional<std::string> tuned_model;
+	autotune_t tuned;
+	if (autotune_fps > 0) {
+		std::vector<pipeline_t*> tunable;
+		std::map<std::string, bool> explicit_models;
+		for (auto &p : pipelines) {
+			if (p->default_model)
+				tunable.push_back(p.get());
+			else
+				explicit_models[p->s_model.value()] = true;
+		}
+		if (tunable.empty()) {
+			fprintf(stderr, "Warning: --autotune ignored, all pipelines specify a model\n");
+		} else {
+			pipeline_t &first = *tunable.front();
+			cv::Mat sample;
+			if (first.vcap) {
+				grab_native(first, sample);
+			} else {
+				first.cap.read(sample);
+				if (!sample.empty() && first.crop_region.height)
+					sample = sample(first.crop_region).clone();
+			}
+			auto resolve = [](const std::string& m) { return resolve_path(m, "models"); };
+			size_t budget = std::max((size_t)1, threads / (explicit_models.size() + 1));
+			if (!autotune(autotune_fps, first.mask.cols, first.mask.rows, tunable.size(), budget, resolve, sample, debug, tuned))
+				exit(1);
+			tuned_model = resolve(tuned.model);
+			for (auto p : tunable) {
+				p->model = tuned.model;
+				p->s_model = tuned_model;
+			}
 		}
-	}
-	// default green screen background (at capture true geometry)
-	cv::Mat bg;
-	if ( crop_region.height == 0) {
-		bg = cv::Mat(capGeo.value().second, capGeo.value().first, CV_8UC3, cv::Scalar(0, 255, 0));
-	} else {
-		bg = cv::Mat(crop_region.width, crop_region.height, CV_8UC3, cv::Scalar(0, 255, 0));
 	}
 
-	// Virtual camera (at specified geometry)
-	int lbfd = loopback_init(s_vcam, vidGeo.value().first, vidGeo.value().second, debug);
-	if(lbfd < 0) {
-		fprintf(stderr, "Failed to initialize vcam device.\n");
-		exit(1);
+	// One mask generator per distinct model, shared by all pipelines using it
+	// (as a batch). The thread budget is split between models.
+	std::map<std::string, std::vector<pipeline_t*>> bymodel;
+	for (auto &p : pipelines)
+		bymodel[p->s_model.value()].push_back(p.get());
+	size_t model_threads = std::max((size_t)1, threads / bymodel.size());
+	printf("threads:%zu (%zu per model, %zu model(s), %zu stream(s))\n", threads, model_threads, bymodel.size(), pipelines.size());
+	std::vector<std::unique_ptr<CalcMask>> ais;
+	for (auto &group : bymodel) {
+		const pipeline_t &first = *group.second.front();
+		bs_maskgen_opts_t opts;
+		opts.threads = model_threads;
+		if (group.second.size() == 1) {
+			opts.interpreters = interpreters;
+			opts.threads = std::max((size_t)1, model_threads / interpreters);
+		}
+		opts.motion_gate = motion_gate / 100;
+		opts.motion_max_skip = motion_max_skip;
+		opts.denoise = denoise;
+		opts.roi_tracking = roi_redetect > 0;
+		if (roi_redetect)
+			opts.roi_redetect = roi_redetect;
+		if (tuned_model && group.first == tuned_model.value()) {
+			opts.threads = tuned.threads;
+			opts.xnnpack = tuned.xnnpack;
+		}
+		ais.push_back(std::make_unique<CalcMask>(group.first, opts, first.mask.cols, first.mask.rows, group.second.size(),
+			std::max((size_t)1, flow_cadence), !settings.propagate));
+		for (size_t i = 0; i < group.second.size(); i++) {
+			group.second[i]->ai = ais.back().get();
+			group.second[i]->ai_stream = i;
+		}
 	}
 
-	on_scope_exit lbfd_closer([lbfd]() {
-		loopback_free(lbfd);
-	});
-
+	printf("Startup: %ldns\n", diffnanosecs(timestamp(), bootns));
 
-	// Processing components, all at capture true geometry
-    cv::Mat mask;
-    if ( crop_region.height ) {
-		cv::Mat masktmp((int)(crop_region.height), (int)(crop_region.width), CV_8U);
-		mask = masktmp;
-	} else {
-		cv::Mat masktmp(capGeo.value().second, capGeo.value().first, CV_8U);
-		mask = masktmp;
+	// daemon mode: every pipeline runs on its own thread until killed
+	if (pipelines.size() > 1) {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < pipelines.size(); i++)
+			workers.emplace_back(run_pipeline, pipelines[i].get(), &settings, i, showProgress);
+		for (auto &w : workers)
+			w.join();
+		return 0;
 	}
 
-	cv::Mat raw;
-	int aiw, aih;
-	std::tie(aiw, aih) = !crop_region.width ?
-		{ capGeo.value().first, capGeo.value().second } :
-		{ crop_region.width, crop_region.height };
-	CalcMask ai(s_model.value(), threads, aiw, aih);
-
+	pipeline_t &pl = *pipelines.front();
+	timinginfo_t &ti = pl.ti;
+	CalcMask &ai = *pl.ai;
+	cv::Mat &out = pl.out;
+	cv::Mat &mask = pl.mask;
+	auto &pbk = pl.pbk;
+	capGeo = pl.capGeo;
+	vidGeo = pl.vidGeo;
 	ti.lastns = timestamp();
-	printf("Startup: %ldns\n", diffnanosecs(ti.lastns,ti.bootns));
 
 	bool filterActive = true;
 
 	// mainloop
 	for(bool running = true; running; ) {
-		// grab new frame from cam
-		cap.grab();
-		ti.grabns = timestamp();
-		// copy new frame to buffer
-		cap.retrieve(raw);
-		ti.retrns = timestamp();
-		ti.copyns = timestamp();
-
-		if (raw.rows == 0 || raw.cols == 0) continue; // sanity check
-
-		if ( crop_region.height) {
-			raw((cv::Rect_<int>)crop_region).copyTo(raw);
-		}
-
-		ai.set_input_frame(raw);
-
-		if (filterActive) {
-			// do background detection magic
-			ai.get_output_mask(mask);
-
-			// get background frame:
-			// - specified source if set
-			// - copy of input video if blur_strength != 0
-			// - default green (initial value)
-			bool canBlur = false;
-			if (pbk) {
-				int tw,th;
-				if ( crop_region.height ) {
-					tw = crop_region.width;
-					th = crop_region.height;
-				} else {
-					tw = capGeo.value().first;
-					th = capGeo.value().second;
-				}
-				if (grab_background(pbk, tw, th, bg) < 0)
-					throw "Failed to read background frame";
-				canBlur = true;
-			} else if (blur_strength) {
-				raw.copyTo(bg);
-				canBlur = true;
-			}
-			// blur frame if requested (unless it's just green)
-			if (canBlur && blur_strength)
-				cv::GaussianBlur(bg,bg,cv::Size(blur_strength,blur_strength), 0);
-			ti.prepns = timestamp();
-			// alpha blend background over foreground using mask
-			raw = alpha_blend(bg, raw, mask);
-		} else {
-			ti.prepns = timestamp();
-		}
-		ti.maskns = timestamp();
-
-		if (flipHorizontal && flipVertical) {
-			cv::flip(raw, raw, -1);
-		} else if (flipHorizontal) {
-			cv::flip(raw, raw, 1);
-		} else if (flipVertical) {
-			cv::flip(raw, raw, 0);
-		}
-		ti.postns = timestamp();
-
-		// scale to virtual camera geometry (if required)
-		if (vidGeo != capGeo) {
-			cv::resize(raw, raw, cv::Size(vidGeo.value().first,vidGeo.value().second));
-		}
-		// write frame to v4l2loopback as YUYV
-		raw = convert_rgb_to_yuyv(raw);
-		int framesize = raw.step[0]*raw.rows;
-		while (framesize > 0) {
-			int ret = write(lbfd,raw.data,framesize);
-			if(ret <= 0) {
-				perror("writing to loopback device");
-				exit(1);
-			}
-			framesize -= ret;
-		}
-		ti.v4l2ns=timestamp();
+		if (!step_pipeline(pl, settings, filterActive))
+			continue;
 
 		if (!debug) {
 			if (showProgress) {
@@ -741,7 +1372,7 @@ int main(int argc, char* argv[]) try {
 		// timing details..
 		double mfps = 1e9/diffnanosecs(ti.v4l2ns,ti.lastns);
 		double afps = 1e9/ai.loopns;
-		printf("main [grab:%9ld retr:%9ld copy:%9ld prep:%9ld mask:%9ld post:%9ld v4l2:%9ld FPS: %5.2f] ai: [wait:%9ld prep:%9ld tflt:%9ld mask:%9ld FPS: %5.2f] \e[K\r",
+		printf("main [grab:%9ld retr:%9ld copy:%9ld prep:%9ld mask:%9ld post:%9ld v4l2:%9ld FPS: %5.2f drop: %lu] ai: [wait:%9ld prep:%9ld (dnse:%9ld) tflt:%9ld mask:%9ld FPS: %5.2f gate: %3.0f%%] \e[K\r",
 			diffnanosecs(ti.grabns,ti.lastns),
 			diffnanosecs(ti.retrns,ti.grabns),
 			diffnanosecs(ti.copyns,ti.retrns),
@@ -750,11 +1381,14 @@ int main(int argc, char* argv[]) try {
 			diffnanosecs(ti.postns,ti.maskns),
 			diffnanosecs(ti.v4l2ns,ti.postns),
 			mfps,
+			(unsigned long)capture_dropped(pl.vcap),
 			ai.waitns,
 			ai.prepns,
+			ai.dnsens,
 			ai.tfltns,
 			ai.maskns,
-			afps
+			afps,
+			ai.gatehit
 		);
 		fflush(stdout);
 		ti.lastns = timestamp();
@@ -762,7 +1396,13 @@ int main(int argc, char* argv[]) try {
 			continue;
 
 		cv::Mat test;
-		cv::cvtColor(raw,test,cv::COLOR_YUV2BGR_YUYV);
+		static const std::map<bs_pixfmt_t, int> to_bgr = {
+			{ bs_pixfmt_t::YUYV, cv::COLOR_YUV2BGR_YUYV },
+			{ bs_pixfmt_t::NV12, cv::COLOR_YUV2BGR_NV12 },
+			{ bs_pixfmt_t::I420, cv::COLOR_YUV2BGR_I420 },
+			{ bs_pixfmt_t::RGB24, cv::COLOR_RGB2BGR },
+		};
+		cv::cvtColor(out,test,to_bgr.at(settings.pixfmt));
 		// frame rates & sizes at the bottom
 		if (showFPS) {
 			char status[80];
@@ -823,10 +1463,10 @@ int main(int argc, char* argv[]) try {
 				filterActive = !filterActive;
 				break;
 			case 'h':
-				flipHorizontal = !flipHorizontal;
+				settings.flipHorizontal = !settings.flipHorizontal;
 				break;
 			case 'v':
-				flipVertical = !flipVertical;
+				settings.flipVertical = !settings.flipVertical;
 				break;
 			case 'f':
 				showFPS = !showFPS;
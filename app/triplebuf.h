@@ -0,0 +1,41 @@
+/* This is licensed software, @see LICENSE file.
+ * Authors - @see AUTHORS file. */
+
+#ifndef _TRIPLEBUF_H_
+#define _TRIPLEBUF_H_
+
+#include <atomic>
+
+// Lock-free single producer / single consumer handoff of the latest value.
+// The producer fills its back slot and publishes it, the consumer takes the
+// most recently published slot. Neither side ever waits for the other, an
+// unread value is simply replaced, and slots are reused rather than copied.
+template<typename T>
+class triple_buffer_t {
+    T slots[3];
+    // slots owned by the producer and by the consumer
+    int back = 0;
+    int front = 1;
+    // slot in between, flagged while it holds a value not taken yet
+    static const int FRESH = 4;
+    std::atomic<int> middle{2};
+
+public:
+    // producer: the slot to fill, then hand it over
+    T& write_slot() { return slots[back]; }
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;
+    }
+
+    // consumer: switch to the latest published value, false if nothing was
+    // published since the last take (read_slot then keeps the previous one)
+    bool take() {
+        if (!(middle.load(std::memory_order_acquire) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    T& read_slot() { return slots[front]; }
+};
+
+#endif
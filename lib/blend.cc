@@ -0,0 +1,133 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include "simd.h"
+#include "blend.h"
+
+static void blend_scalar(const uint8_t *bg, const uint8_t *fg, const uint8_t *mask, size_t n, uint8_t *out) {
+	for (size_t i = 0; i < n; i++, bg += 3, fg += 3, out += 3) {
+		unsigned bw = mask[i], fw = 255 - bw;
+		uint8_t c0 = div255(bg[0]*bw + fg[0]*fw);
+		uint8_t c1 = div255(bg[1]*bw + fg[1]*fw);
+		uint8_t c2 = div255(bg[2]*bw + fg[2]*fw);
+		out[0] = c0;
+		out[1] = c1;
+		out[2] = c2;
+	}
+}
+
+#if defined(BS_SIMD_X86)
+
+// Spread 16 mask bytes over the 48 bytes of 16 BGR pixels, one shuffle per
+// 16 output bytes
+BS_TARGET_SSE41 static inline void spread_mask(__m128i m, __m128i mx[3]) {
+	const __m128i s0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+	const __m128i s1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+	const __m128i s2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+	mx[0] = _mm_shuffle_epi8(m, s0);
+	mx[1] = _mm_shuffle_epi8(m, s1);
+	mx[2] = _mm_shuffle_epi8(m, s2);
+}
+
+// 16 bit lanes: (b * m + f * (255 - m) + 128) * 257 >> 16
+BS_TARGET_AVX2 static inline __m256i blend16_avx2(__m256i b, __m256i f, __m256i m) {
+	const __m256i v255 = _mm256_set1_epi16(255), v128 = _mm256_set1_epi16(128), v257 = _mm256_set1_epi16(257);
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(b, m), _mm256_mullo_epi16(f, _mm256_sub_epi16(v255, m)));
+	return _mm256_mulhi_epu16(_mm256_add_epi16(t, v128), v257);
+}
+
+BS_TARGET_AVX2 static void blend_avx2(const uint8_t *bg, const uint8_t *fg, const uint8_t *mask, size_t n, uint8_t *out) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i mx[3];
+		spread_mask(_mm_loadu_si128((const __m128i *)(mask + i)), mx);
+		for (int k = 0; k < 3; k++) {
+			const size_t o = 3*i + 16*k;
+			__m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(bg + o)));
+			__m256i f = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(fg + o)));
+			__m256i r = blend16_avx2(b, f, _mm256_cvtepu8_epi16(mx[k]));
+			// packus works per 128 bit lane, gather both halves into the low one
+			r = _mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), 0x08);
+			_mm_storeu_si128((__m128i *)(out + o), _mm256_castsi256_si128(r));
+		}
+	}
+	blend_scalar(bg + 3*i, fg + 3*i, mask + i, n - i, out + 3*i);
+}
+
+BS_TARGET_SSE41 static inline __m128i blend8_sse41(__m128i b, __m128i f, __m128i m) {
+	const __m128i v255 = _mm_set1_epi16(255), v128 = _mm_set1_epi16(128), v257 = _mm_set1_epi16(257);
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(b, m), _mm_mullo_epi16(f, _mm_sub_epi16(v255, m)));
+	return _mm_mulhi_epu16(_mm_add_epi16(t, v128), v257);
+}
+
+BS_TARGET_SSE41 static void blend_sse41(const uint8_t *bg, const uint8_t *fg, const uint8_t *mask, size_t n, uint8_t *out) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i mx[3];
+		spread_mask(_mm_loadu_si128((const __m128i *)(mask + i)), mx);
+		for (int k = 0; k < 3; k++) {
+			const size_t o = 3*i + 16*k;
+			__m128i b = _mm_loadu_si128((const __m128i *)(bg + o));
+			__m128i f = _mm_loadu_si128((const __m128i *)(fg + o));
+			__m128i lo = blend8_sse41(_mm_cvtepu8_epi16(b), _mm_cvtepu8_epi16(f), _mm_cvtepu8_epi16(mx[k]));
+			__m128i hi = blend8_sse41(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(f, zero), _mm_unpackhi_epi8(mx[k], zero));
+			_mm_storeu_si128((__m128i *)(out + o), _mm_packus_epi16(lo, hi));
+		}
+	}
+	blend_scalar(bg + 3*i, fg + 3*i, mask + i, n - i, out + 3*i);
+}
+
+#endif // BS_SIMD_X86
+
+#if defined(BS_SIMD_NEON)
+
+// one channel plane of 16 pixels, rounded t / 255 as (t' + (t' >> 8)) >> 8
+// with t' = t + 128, which equals t' * 257 >> 16
+static inline uint8x16_t blend16_neon(uint8x16_t b, uint8x16_t f, uint8x16_t m, uint8x16_t im) {
+	const uint16x8_t v128 = vdupq_n_u16(128);
+	uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(b), vget_low_u8(m)), vget_low_u8(f), vget_low_u8(im));
+	uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(b), vget_high_u8(m)), vget_high_u8(f), vget_high_u8(im));
+	lo = vaddq_u16(lo, v128);
+	hi = vaddq_u16(hi, v128);
+	return vcombine_u8(vaddhn_u16(lo, vshrq_n_u16(lo, 8)), vaddhn_u16(hi, vshrq_n_u16(hi, 8)));
+}
+
+static void blend_neon(const uint8_t *bg, const uint8_t *fg, const uint8_t *mask, size_t n, uint8_t *out) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		// de-interleaved loads leave one plane per channel, matching the mask
+		uint8x16x3_t b = vld3q_u8(bg + 3*i);
+		uint8x16x3_t f = vld3q_u8(fg + 3*i);
+		uint8x16_t m = vld1q_u8(mask + i);
+		uint8x16_t im = vmvnq_u8(m);
+		uint8x16x3_t r;
+		for (int c = 0; c < 3; c++)
+			r.val[c] = blend16_neon(b.val[c], f.val[c], m, im);
+		vst3q_u8(out + 3*i, r);
+	}
+	blend_scalar(bg + 3*i, fg + 3*i, mask + i, n - i, out + 3*i);
+}
+
+#endif // BS_SIMD_NEON
+
+void blend_bgr(const uint8_t *bg, const uint8_t *fg, const uint8_t *mask, size_t n, uint8_t *out) {
+	switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+		case simd_level_t::AVX2:
+			blend_avx2(bg, fg, mask, n, out);
+			return;
+		case simd_level_t::SSE41:
+			blend_sse41(bg, fg, mask, n, out);
+			return;
+#endif
+#if defined(BS_SIMD_NEON)
+		case simd_level_t::NEON:
+			blend_neon(bg, fg, mask, n, out);
+			return;
+#endif
+		default:
+			blend_scalar(bg, fg, mask, n, out);
+	}
+}
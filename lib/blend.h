@@ -0,0 +1,25 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _BLEND_H
+#define _BLEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Alpha blending of packed BGR pixels with a per pixel 8-bit weight, mask
+// 255 => background: out = (bg * m + fg * (255 - m)) / 255, rounded to
+// nearest. The division is the exact x / 255 = (x + 128) * 257 >> 16 for
+// x <= 255 * 255, so every kernel variant produces identical bytes.
+
+// Rounded x / 255 for x in [0, 255 * 255]
+static inline uint8_t div255(unsigned x) {
+	return (uint8_t)(((x + 128) * 257) >> 16);
+}
+
+// Blend n pixels (3n bytes) of bg and fg under mask (n bytes) into out,
+// which may alias fg or bg
+void blend_bgr(const uint8_t *bg, const uint8_t *fg, const uint8_t *mask, size_t n, uint8_t *out);
+
+#endif
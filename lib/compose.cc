@@ -0,0 +1,156 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+
+#include "compose.h"
+
+// fewest frame rows in a stripe, whatever the cache size
+#define COMPOSE_MIN_ROWS 8
+
+// Bytes of frame data a stripe may touch: half the L2 cache when the C
+// library knows its size, else half of a typical 1MB
+static size_t stripe_bytes() {
+	static const size_t bytes = [] {
+		long l2 = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+		l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+		return (size_t)(l2 > 0 ? l2 : 1 << 20) / 2;
+	}();
+	return bytes;
+}
+
+// Frame rows sampled by output row oy, with the Q8 weight of the second
+static void source_rows(const compose_t &c, const cv::Mat &fg, const compose_out_t &o, int oy, int &ya, int &yb, int &wy) {
+	if (o.size == fg.size()) {
+		ya = yb = o.flip_v ? fg.rows - 1 - oy : oy;
+		wy = 0;
+		return;
+	}
+	// mirroring the sampling position equals mirroring the frame, the
+	// pixel-centre convention of the tables is symmetric
+	const int ry = o.flip_v ? o.size.height - 1 - oy : oy;
+	ya = c.map.y0[ry];
+	yb = c.map.y1[ry];
+	wy = (int)lrintf(c.map.yw[ry] * 256.0f);
+}
+
+// Bilinear output row from frame rows ra and rb, mirrored on request
+static void scale_row(const compose_t &c, const uint8_t *ra, const uint8_t *rb, int wy, bool flip, int width, uint8_t *out) {
+	const int *x0 = c.map.x0.data(), *x1 = c.map.x1.data(), *xw = c.xw8.data();
+	for (int ox = 0; ox < width; ox++, out += 3) {
+		const int rx = flip ? width - 1 - ox : ox;
+		const uint8_t *a0 = ra + 3*x0[rx], *a1 = ra + 3*x1[rx];
+		const uint8_t *b0 = rb + 3*x0[rx], *b1 = rb + 3*x1[rx];
+		const int wx = xw[rx];
+		for (int ch = 0; ch < 3; ch++) {
+			int t = a0[ch]*(256 - wx) + a1[ch]*wx;
+			int b = b0[ch]*(256 - wx) + b1[ch]*wx;
+			out[ch] = (uint8_t)((t*(256 - wy) + b*wy + (1 << 15)) >> 16);
+		}
+	}
+}
+
+static void rgb_row(const uint8_t *bgr, int width, uint8_t *out) {
+	for (int x = 0; x < width; x++, bgr += 3, out += 3) {
+		out[0] = bgr[2];
+		out[1] = bgr[1];
+		out[2] = bgr[0];
+	}
+}
+
+static void mirror_row(const uint8_t *in, int width, uint8_t *out) {
+	const uint8_t *p = in + 3*(width - 1);
+	for (int x = 0; x < width; x++, p -= 3, out += 3) {
+		out[0] = p[0];
+		out[1] = p[1];
+		out[2] = p[2];
+	}
+}
+
+void compose_frame(compose_t &c, const cv::Mat &fg, const compose_blend_t &blend, const compose_out_t &o) {
+	CV_Assert(fg.type() == CV_8UC3 && !fg.empty() && o.data && o.coeffs);
+	const bool rgb = compose_format_t::RGB24 == o.format;
+	const bool planar = compose_format_t::NV12 == o.format || compose_format_t::I420 == o.format;
+	CV_Assert(o.size.width > 0 && o.size.height > 0 && (rgb || !(o.size.width & 1)) && (!planar || !(o.size.height & 1)));
+	CV_Assert(o.stride >= (size_t)o.size.width * (rgb ? 3 : planar ? 1 : 2) && (compose_format_t::I420 != o.format || !(o.stride & 1)));
+	const bool scaled = o.size != fg.size();
+	if (scaled && (c.map.ssize != fg.size() || c.map.dsize != o.size)) {
+		prep_map_init(c.map, fg.size(), o.size);
+		c.xw8.resize(o.size.width);
+		for (int x = 0; x < o.size.width; x++)
+			c.xw8[x] = (int)lrintf(c.map.xw[x] * 256.0f);
+	}
+	// frame, background and composited rows of a stripe stay in cache
+	const int frows = std::max(COMPOSE_MIN_ROWS, (int)(stripe_bytes() / ((size_t)fg.cols * 3 * 3)));
+	int orows = std::max(1, (int)((int64_t)frows * o.size.height / fg.rows));
+	// 4:2:0 output rows are converted in pairs
+	if (planar)
+		orows = std::max(2, orows & ~1);
+	const size_t stripes = (o.size.height + orows - 1) / orows;
+	workers_run(c.workers, stripes, [&](size_t n) {
+		// composited frame rows of the stripe, scaled/mirrored output rows
+		// (a pair for 4:2:0)
+		static thread_local cv::Mat stripe, lines;
+		if (scaled || o.flip_h)
+			lines.create(2, o.size.width, CV_8UC3);
+		const int o0 = (int)n * orows, o1 = std::min(o.size.height, o0 + orows);
+		// frame rows feeding this stripe
+		int s0 = fg.rows, s1 = 0;
+		for (int oy = o0; oy < o1; oy++) {
+			int ya, yb, wy;
+			source_rows(c, fg, o, oy, ya, yb, wy);
+			s0 = std::min(s0, std::min(ya, yb));
+			s1 = std::max(s1, std::max(ya, yb) + 1);
+		}
+		cv::Mat rows = fg.rowRange(s0, s1);
+		if (blend) {
+			if (stripe.rows < s1 - s0 || stripe.cols != fg.cols)
+				stripe.create(std::max(s1 - s0, frows + 2), fg.cols, CV_8UC3);
+			rows = stripe.rowRange(0, s1 - s0);
+			blend(s0, s1, rows);
+		}
+		// BGR output row oy, built in lines row i if need be
+		auto bgr_row = [&](int oy, int i) {
+			int ya, yb, wy;
+			source_rows(c, fg, o, oy, ya, yb, wy);
+			const uint8_t *src = rows.ptr<uint8_t>(ya - s0);
+			if (scaled) {
+				scale_row(c, src, rows.ptr<uint8_t>(yb - s0), wy, o.flip_h, o.size.width, lines.ptr<uint8_t>(i));
+				src = lines.ptr<uint8_t>(i);
+			} else if (o.flip_h) {
+				mirror_row(src, fg.cols, lines.ptr<uint8_t>(i));
+				src = lines.ptr<uint8_t>(i);
+			}
+			return src;
+		};
+		uint8_t *chroma = o.data + o.size.height * o.stride;
+		switch (o.format) {
+		case compose_format_t::YUYV:
+			for (int oy = o0; oy < o1; oy++)
+				yuv_yuyv_row(bgr_row(oy, 0), o.size.width, *o.coeffs, o.data + oy * o.stride);
+			break;
+		case compose_format_t::RGB24:
+			for (int oy = o0; oy < o1; oy++)
+				rgb_row(bgr_row(oy, 0), o.size.width, o.data + oy * o.stride);
+			break;
+		case compose_format_t::NV12:
+			for (int oy = o0; oy < o1; oy += 2)
+				yuv_nv12_rows(bgr_row(oy, 0), bgr_row(oy + 1, 1), o.size.width, *o.coeffs,
+					o.data + oy * o.stride, o.data + (oy + 1) * o.stride, chroma + oy / 2 * o.stride);
+			break;
+		case compose_format_t::I420: {
+			const size_t cstride = o.stride / 2, cplane = cstride * (o.size.height / 2);
+			for (int oy = o0; oy < o1; oy += 2)
+				yuv_i420_rows(bgr_row(oy, 0), bgr_row(oy + 1, 1), o.size.width, *o.coeffs,
+					o.data + oy * o.stride, o.data + (oy + 1) * o.stride,
+					chroma + oy / 2 * cstride, chroma + cplane + oy / 2 * cstride);
+			break;
+		}
+		}
+	});
+}
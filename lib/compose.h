@@ -0,0 +1,63 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _COMPOSE_H
+#define _COMPOSE_H
+
+#include <functional>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "preprocess.h"
+#include "workers.h"
+#include "yuv.h"
+
+// Fused output stage: blend -> flip -> scale -> convert, one horizontal stripe
+// at a time. A stripe spans as many frame rows as fit half the L2 cache, so
+// composited rows are still cached when they are scaled and converted, and
+// the only full frame written is the output itself. Stripes are independent
+// and run in parallel on a worker pool.
+
+// Blend frame rows [y0, y1) into dst (y1 - y0 rows, 8UC3), called for
+// several stripes at once
+typedef std::function<void(int y0, int y1, cv::Mat &dst)> compose_blend_t;
+
+// Output pixel formats, laid out as single planar V4L2 buffers: planes
+// back to back, the I420 chroma planes at half the luma stride
+enum class compose_format_t {
+	YUYV,
+	NV12,
+	I420,
+	RGB24,
+};
+
+// Output frame: geometry (the frame is scaled bilinearly when it differs),
+// mirroring, format, colour matrix and destination (stride: of the first
+// plane)
+struct compose_out_t {
+	cv::Size size;
+	bool flip_h = false;
+	bool flip_v = false;
+	compose_format_t format = compose_format_t::YUYV;
+	const yuv_coeffs_t *coeffs = &yuv_bt601;
+	uint8_t *data = nullptr;
+	size_t stride = 0;
+};
+
+// Tables kept between frames
+struct compose_t {
+	// frame to output scaling tables, column weights in Q8
+	prep_map_t map;
+	std::vector<int> xw8;
+	// pool running the stripes (nullptr: all on the caller)
+	workers_t *workers = nullptr;
+};
+
+// Write the output frame for fg (8UC3), passing each stripe through blend
+// first unless it is empty. Y'CbCr formats need an even width, 4:2:0 an
+// even height as well.
+void compose_frame(compose_t &c, const cv::Mat &fg, const compose_blend_t &blend, const compose_out_t &out);
+
+#endif
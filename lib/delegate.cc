@@ -0,0 +1,64 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include "tensorflow/lite/builtin_ops.h"
+#ifdef TFLITE_BUILD_WITH_XNNPACK_DELEGATE
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
+#endif
+
+#include "delegate.h"
+
+// count delegate kernels and left-over reference nodes in the execution plan
+static void count_nodes(tflite::Interpreter &interpreter, bs_delegate_info_t &info) {
+	size_t reference = 0;
+	info.partitions = 0;
+	for (int idx : interpreter.execution_plan()) {
+		const auto *nr = interpreter.node_and_registration(idx);
+		if (nr && nr->second.builtin_code == kTfLiteBuiltinDelegate)
+			info.partitions++;
+		else
+			reference++;
+	}
+	info.delegated = info.nodes > reference ? info.nodes - reference : 0;
+}
+
+void update_xnnpack_info(tflite::Interpreter &interpreter, bs_delegate_info_t &info) {
+	count_nodes(interpreter, info);
+}
+
+tflite::Interpreter::TfLiteDelegatePtr apply_xnnpack(tflite::Interpreter &interpreter,
+	const bs_maskgen_opts_t &opts, bs_delegate_info_t &info, std::string &err) {
+	tflite::Interpreter::TfLiteDelegatePtr none(nullptr, [](TfLiteDelegate *) {});
+	info = bs_delegate_info_t();
+	info.nodes = interpreter.execution_plan().size();
+	err.clear();
+	if (!opts.xnnpack)
+		return none;
+#ifdef TFLITE_BUILD_WITH_XNNPACK_DELEGATE
+	TfLiteXNNPackDelegateOptions xopts = TfLiteXNNPackDelegateOptionsDefault();
+	xopts.num_threads = (int32_t)opts.threads;
+#ifdef TFLITE_XNNPACK_DELEGATE_FLAG_QS8
+	// the defaults may enable them already (XNNPACK_DELEGATE_ENABLE_QS8/QU8)
+	if (opts.quantized)
+		xopts.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QS8 | TFLITE_XNNPACK_DELEGATE_FLAG_QU8;
+	else
+		xopts.flags &= ~(TFLITE_XNNPACK_DELEGATE_FLAG_QS8 | TFLITE_XNNPACK_DELEGATE_FLAG_QU8);
+#endif
+	tflite::Interpreter::TfLiteDelegatePtr delegate(TfLiteXNNPackDelegateCreate(&xopts), TfLiteXNNPackDelegateDelete);
+	if (!delegate) {
+		err = "unable to create XNNPACK delegate";
+		return none;
+	}
+	if (interpreter.ModifyGraphWithDelegate(delegate.get()) != kTfLiteOk) {
+		err = "XNNPACK delegate rejected the model graph";
+		return none;
+	}
+	info.active = true;
+	count_nodes(interpreter, info);
+	return delegate;
+#else
+	err = "XNNPACK delegate not built in";
+	return none;
+#endif
+}
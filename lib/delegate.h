@@ -0,0 +1,27 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _DELEGATE_H
+#define _DELEGATE_H
+
+#include <string>
+
+#include "tensorflow/lite/interpreter.h"
+
+#include "libbackscrub.h"
+
+// Explicit XNNPACK delegate management. We build interpreters without the
+// implicit default delegate, so applying (or not applying) XNNPACK is our
+// decision and we can tell exactly how much of the graph it took over.
+
+// Create the XNNPACK delegate per opts and apply it to the interpreter.
+// Returns the delegate (which must outlive the interpreter) or nullptr if
+// not requested, not built in or rejected, with err set on failure.
+tflite::Interpreter::TfLiteDelegatePtr apply_xnnpack(tflite::Interpreter &interpreter,
+	const bs_maskgen_opts_t &opts, bs_delegate_info_t &info, std::string &err);
+
+// Recount delegated nodes after the graph was re-prepared (eg: input resize)
+void update_xnnpack_info(tflite::Interpreter &interpreter, bs_delegate_info_t &info);
+
+#endif
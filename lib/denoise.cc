@@ -0,0 +1,83 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <cmath>
+#include <algorithm>
+
+#include "denoise.h"
+
+// filter taps either side of the centre pixel
+#define DENOISE_RADIUS 2
+
+// Filter one RGB pixel c from the taps of one pass direction (c included)
+static inline void bilateral_px(const float *c, const float *const *nb, float k, float *out) {
+	float acc0 = 0, acc1 = 0, acc2 = 0, wsum = 0;
+	for (int t = 0; t < 2*DENOISE_RADIUS+1; t++) {
+		const float *n = nb[t];
+		float d0 = n[0] - c[0], d1 = n[1] - c[1], d2 = n[2] - c[2];
+		float w = 1.0f / (1.0f + (d0*d0 + d1*d1 + d2*d2) * k);
+		acc0 += w * n[0];
+		acc1 += w * n[1];
+		acc2 += w * n[2];
+		wsum += w;
+	}
+	// the centre tap has weight 1, so wsum >= 1
+	float inv = 1.0f / wsum;
+	out[0] = acc0 * inv;
+	out[1] = acc1 * inv;
+	out[2] = acc2 * inv;
+}
+
+void denoise_bilateral_sep(const cv::Mat &src, cv::Mat &dst, float sigma, cv::Mat &tmp) {
+	CV_Assert(src.type() == CV_32FC3);
+	const float k = 1.0f / (2.0f * sigma * sigma);
+	const int w = src.cols, h = src.rows;
+	tmp.create(src.size(), CV_32FC3);
+	dst.create(src.size(), CV_32FC3);
+	const float *nb[2*DENOISE_RADIUS+1];
+	// horizontal: src -> tmp
+	for (int y = 0; y < h; y++) {
+		const float *in = src.ptr<float>(y);
+		float *out = tmp.ptr<float>(y);
+		for (int x = 0; x < w; x++) {
+			for (int t = -DENOISE_RADIUS; t <= DENOISE_RADIUS; t++)
+				nb[t+DENOISE_RADIUS] = in + 3*std::min(std::max(x+t, 0), w-1);
+			bilateral_px(in + 3*x, nb, k, out + 3*x);
+		}
+	}
+	// vertical: tmp -> dst
+	for (int y = 0; y < h; y++) {
+		const float *rows[2*DENOISE_RADIUS+1];
+		for (int t = -DENOISE_RADIUS; t <= DENOISE_RADIUS; t++)
+			rows[t+DENOISE_RADIUS] = tmp.ptr<float>(std::min(std::max(y+t, 0), h-1));
+		const float *in = tmp.ptr<float>(y);
+		float *out = dst.ptr<float>(y);
+		for (int x = 0; x < w; x++) {
+			for (int t = 0; t < 2*DENOISE_RADIUS+1; t++)
+				nb[t] = rows[t] + 3*x;
+			bilateral_px(in + 3*x, nb, k, out + 3*x);
+		}
+	}
+}
+
+void denoise_temporal(const cv::Mat &src, cv::Mat &acc, float alpha, float motion, cv::Mat &dst) {
+	CV_Assert(src.type() == CV_32FC3);
+	if (acc.empty() || acc.size() != src.size()) {
+		src.copyTo(acc);
+		src.copyTo(dst);
+		return;
+	}
+	for (int y = 0; y < src.rows; y++) {
+		const float *in = src.ptr<float>(y);
+		float *avg = acc.ptr<float>(y);
+		for (int x = 0; x < src.cols; x++, in += 3, avg += 3) {
+			float d = std::max(std::fabs(in[0] - avg[0]), std::max(std::fabs(in[1] - avg[1]), std::fabs(in[2] - avg[2])));
+			float a = d > motion ? 1.0f : alpha;
+			avg[0] += a * (in[0] - avg[0]);
+			avg[1] += a * (in[1] - avg[1]);
+			avg[2] += a * (in[2] - avg[2]);
+		}
+	}
+	acc.copyTo(dst);
+}
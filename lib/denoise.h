@@ -0,0 +1,24 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _DENOISE_H
+#define _DENOISE_H
+
+#include <opencv2/core/core.hpp>
+
+// Cheaper alternatives to cv::bilateralFilter for the model input, all on
+// normalized RGB floats (32FC3) at model resolution.
+
+// Separable bilateral approximation: a 5 tap horizontal then vertical pass,
+// weighting neighbours by 1 / (1 + |dRGB|^2 / (2 sigma^2)) (sigma in input
+// units). The spatial weight is flat, as with the sigma of 100 we used with
+// cv::bilateralFilter. tmp is scratch space.
+void denoise_bilateral_sep(const cv::Mat &src, cv::Mat &dst, float sigma, cv::Mat &tmp);
+
+// Temporal averaging into acc: acc += alpha * (src - acc), except where a
+// pixel moved by more than motion (input units), which takes src as is.
+// acc (re)starts from src when empty, dst receives the average.
+void denoise_temporal(const cv::Mat &src, cv::Mat &acc, float alpha, float motion, cv::Mat &dst);
+
+#endif
@@ -2,6 +2,13 @@
  * Authors - @see AUTHORS file.
 ==============================================================================*/
 
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+
 #include "tensorflow/lite/version.h"
 #include "tensorflow/lite/interpreter.h"
 #include "tensorflow/lite/kernels/register.h"
@@ -9,6 +16,18 @@
 #include "tensorflow/lite/optional_debug_tools.h"
 
 #include "transpose_conv_bias.h"
+#include "delegate.h"
+#include "preprocess.h"
+#include "postprocess.h"
+#include "motion.h"
+#include "roi.h"
+#include "upsample.h"
+#include "denoise.h"
+#include "blend.h"
+#include "yuv.h"
+#include "compose.h"
+#include "workers.h"
+#include "simd.h"
 #include "libbackscrub.h"
 
 // Internal context structures
@@ -25,11 +44,101 @@ struct normalization_t {
 	float offset;
 };
 
+// Per-stream processing state, each frame position of a batch keeps its own
+struct stream_t {
+	// frame geometry this state was set up for
+	cv::Size size;
+	// model-aspect ROI in the frame, and where it lands in the model input
+	cv::Rect roidim;
+	cv::Rect in_roidim;
+	// temporal noise reduction average (model input size)
+	cv::Mat denoise_acc;
+	// fixed (untracked) ROI, and inferences since it was last used
+	cv::Rect full_roidim;
+	cv::Rect full_in_roidim;
+	size_t roi_age;
+	prep_map_t prepmap;
+	// full-size output mask and its ROI view
+	cv::Mat mask;
+	cv::Mat mroi;
+	// model-size temporal mask and upsampling tables
+	cv::Mat ofinal;
+	// remap target and column table for ROI moves, swapped with ofinal
+	cv::Mat oscratch;
+	std::vector<int> remap_cols;
+	prep_map_t upmap;
+	gf_scratch_t gf_tmp;
+	// guided filter coefficients of the last inference, and whether mask
+	// has been rendered from them
+	cv::Mat gf_a;
+	cv::Mat gf_b;
+	bool mask_valid;
+	// motion gating: signatures of the last inferred and the current frame,
+	// consecutive frames served from the last mask
+	cv::Mat gate_ref;
+	cv::Mat gate_cur;
+	size_t gate_skipped;
+};
+
+// Interpreter with its tensors and scratch buffers. Pipelined contexts own
+// several, so consecutive frames can be in different stages at once.
+struct engine_t {
+	// XNNPACK delegate (if applied), must outlive the interpreter
+	tflite::Interpreter::TfLiteDelegatePtr delegate{nullptr, [](TfLiteDelegate *) {}};
+	std::unique_ptr<tflite::Interpreter> interpreter;
+	// whole tensors with batch items stacked by rows, current batch dimension
+	cv::Mat input;
+	cv::Mat output;
+	size_t batch;
+	// ROI whose letterbox borders each batch item of a float32 input tensor
+	// holds, when it was prepared in place (empty otherwise)
+	std::vector<cv::Rect> input_roidim;
+	// model input scratch buffers
+	cv::Mat prep;
+	cv::Rect prep_roidim;
+	cv::Mat filtered;
+	cv::Mat outf;
+	cv::Mat denoise_tmp;
+	// per batch item guide (frame luma at model output size) for upsampling
+	std::vector<cv::Mat> guides;
+	cv::Mat guide_tmp;
+};
+
+// Asynchronous processing: worker threads (one per engine) and the bounded
+// queues between them and the caller
+struct async_job_t {
+	uint64_t seq;
+	cv::Mat frame;
+};
+
+struct async_t {
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	// signalled on new jobs (or stop), on new results and on finished frames
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::condition_variable turn;
+	std::deque<async_job_t> jobs;
+	std::deque<bs_mask_result_t> results;
+	// pending frame limit, frames taken from the queue but not finished
+	size_t depth;
+	size_t running;
+	// frames taken from the queue, and finished, so far: workers prepare
+	// frames in queue order and finish them in the same order
+	uint64_t taken;
+	uint64_t finished;
+	std::mutex prep_stage;
+	bool lowres;
+	bool stop;
+	void (*ondone)(void *ctx, bs_mask_result_t &result);
+};
+
 struct backscrub_ctx_t {
 	// Loaded inference model
 	std::unique_ptr<tflite::FlatBufferModel> model;
-	// Model interpreter instance
-	std::unique_ptr<tflite::Interpreter> interpreter;
+	// Model interpreter instances, the first is used for direct calls
+	std::vector<engine_t> engines;
+	bs_delegate_info_t delegate_info;
 	// Specific model type & input normalization
 	modeltype_t modeltype;
 	normalization_t norm;
@@ -39,18 +148,32 @@ struct backscrub_ctx_t {
 	void (*oninfer)(void *ctx);
 	void (*onmask)(void *ctx);
 	void *caller_ctx;
-	// Processing state
-	cv::Mat input;
-	cv::Mat output;
-	cv::Rect roidim;
-	cv::Mat mask;
-	cv::Mat mroi;
-	cv::Mat ofinal;
-	cv::Size blur;
-	cv::Mat in_u8_bgr;
-	cv::Rect in_roidim;
+	// Processing state, tensor formats and per batch item sizes
+	tensor_fmt_t in_fmt;
+	tensor_fmt_t out_fmt;
+	cv::Size in_size;
+	cv::Size out_size;
+	std::vector<stream_t> streams;
 	float ratio;
-	float frameratio;
+	// noise reduction mode
+	bs_denoise_t denoise;
+	// person ROI tracking
+	bool roi_tracking;
+	size_t roi_redetect;
+	// motion gating settings & statistics
+	float gate_threshold;
+	size_t gate_max_skip;
+	// written by the engines running each stage, read by bs_maskgen_stats
+	// from any thread, all under stats_lock
+	std::mutex stats_lock;
+	bs_maskgen_stats_t stats;
+	// buffers handed out to callers (coefficients, asynchronous masks),
+	// only used while finishing frames
+	void *pool;
+	// held (shared) by workers while they process a frame and (exclusively)
+	// by direct calls, so the two do not overlap
+	std::shared_mutex busy;
+	std::unique_ptr<async_t> async;
 };
 
 // Debug helper
@@ -82,33 +205,166 @@ static void _dbg(backscrub_ctx_t &ctx, const char *fmt, ...) {
 	va_end(ap);
 }
 
-static cv::Mat getTensorMat(backscrub_ctx_t &ctx, int tnum) {
+// Map a (possibly batched) NHWC tensor as a cv::Mat of N*H rows, item gets H x W
+static cv::Mat getTensorMat(backscrub_ctx_t &ctx, tflite::Interpreter &interpreter, int tnum, tensor_fmt_t &fmt, cv::Size &item) {
 
-	TfLiteType t_type = ctx.interpreter->tensor(tnum)->type;
-	if (kTfLiteFloat32 != t_type) {
-		_dbg(ctx,"error: tensor #%d: is not float32 type (%d)\n", tnum, t_type);
+	const TfLiteTensor *tensor = interpreter.tensor(tnum);
+	int depth;
+	switch (tensor->type) {
+		case kTfLiteFloat32:
+			fmt.type = elem_t::F32;
+			depth = CV_32F;
+			break;
+		case kTfLiteFloat16:
+			// raw half floats, converted by pre/post-processing
+			fmt.type = elem_t::F16;
+			depth = CV_16U;
+			break;
+		case kTfLiteUInt8:
+			fmt.type = elem_t::U8;
+			depth = CV_8U;
+			break;
+		case kTfLiteInt8:
+			fmt.type = elem_t::I8;
+			depth = CV_8S;
+			break;
+		default:
+			_dbg(ctx,"error: tensor #%d: is not float32/float16/uint8/int8 type (%d)\n", tnum, tensor->type);
+			return cv::Mat();
+	}
+	fmt.scale = tensor->params.scale;
+	fmt.zero_point = tensor->params.zero_point;
+	if ((elem_t::U8 == fmt.type || elem_t::I8 == fmt.type) && fmt.scale <= 0) {
+		_dbg(ctx,"error: tensor #%d: quantized without a (per-tensor) scale\n", tnum);
 		return cv::Mat();
 	}
 
-	TfLiteIntArray* dims = ctx.interpreter->tensor(tnum)->dims;
+	TfLiteIntArray* dims = tensor->dims;
 	for (int i = 0; i < dims->size; i++)
 		_dbg(ctx,"tensor #%d: %d\n",tnum,dims->data[i]);
-	if (dims->data[0] != 1) {
-		_dbg(ctx,"error: tensor #%d: is not single vector (%d)\n", tnum, dims->data[0]);
+	if (dims->size != 4 || dims->data[0] < 1) {
+		_dbg(ctx,"error: tensor #%d: is not a batch of images (%d dims)\n", tnum, dims->size);
 		return cv::Mat();
 	}
 
+	int n = dims->data[0];
 	int h = dims->data[1];
 	int w = dims->data[2];
 	int c = dims->data[3];
 
-	float* p_data = ctx.interpreter->typed_tensor<float>(tnum);
+	void* p_data = tensor->data.raw;
 	if (nullptr == p_data) {
 		_dbg(ctx,"error: tensor #%d: unable to obtain data pointer\n", tnum);
 		return cv::Mat();
 	}
 
-	return cv::Mat(h,w,CV_32FC(c),p_data);
+	item = cv::Size(w,h);
+	return cv::Mat(n*h,w,CV_MAKETYPE(depth,c),p_data);
+}
+
+// (Re)initialize stream state for a frame geometry
+static void init_stream(backscrub_ctx_t &ctx, stream_t &s, int width, int height) {
+	float frameratio = (float)height/(float)width;
+	s.size = cv::Size(width, height);
+
+	// initialize mask and model-aspect ROI in center
+	if (frameratio < ctx.ratio) {
+		// if frame is wider than model, then use only the frame center
+		s.roidim = cv::Rect((width-height/ctx.ratio)/2,0,height/ctx.ratio,height);
+		s.in_roidim = cv::Rect(0, 0, ctx.in_size.width, ctx.in_size.height);
+	} else {
+		// if model is wider than the frame, center the frame in the model
+		s.roidim = cv::Rect(0, 0, width, height);
+		s.in_roidim = cv::Rect((ctx.in_size.width-ctx.in_size.height/frameratio)/2, 0, ctx.in_size.height/frameratio,ctx.in_size.height);
+	}
+
+	s.full_roidim = s.roidim;
+	s.full_in_roidim = s.in_roidim;
+	s.roi_age = 0;
+
+	s.mask = cv::Mat::ones(height,width,CV_8UC1)*255;
+	s.mroi = s.mask(s.roidim);
+	s.gf_a.release();
+	s.gf_b.release();
+	s.mask_valid = true;
+	s.denoise_acc.release();
+	prep_map_init(s.prepmap, s.roidim.size(), s.in_roidim.size());
+	prep_map_init(s.upmap, ctx.out_size, s.roidim.size());
+
+	// create Mat for small mask
+	s.ofinal = cv::Mat(ctx.out_size, CV_8UC1, cv::Scalar(255));
+
+	// no reference frame yet, the next frame is always inferred
+	s.gate_ref.release();
+	s.gate_skipped = 0;
+}
+
+// Move the stream ROI, carrying the temporal mask over to the new region
+static void set_roi(backscrub_ctx_t &ctx, stream_t &s, const cv::Rect &roidim, const cv::Rect &in_roidim) {
+	if (roidim == s.roidim && in_roidim == s.in_roidim)
+		return;
+	if (roidim != s.roidim) {
+		roi_remap_mask(s.ofinal, s.roidim, roidim, s.oscratch, s.remap_cols);
+		std::swap(s.ofinal, s.oscratch);
+	}
+	s.roidim = roidim;
+	s.in_roidim = in_roidim;
+	// everything outside the new ROI is background
+	s.mask.setTo(cv::Scalar(255));
+	s.mroi = s.mask(s.roidim);
+	prep_map_init(s.prepmap, s.roidim.size(), s.in_roidim.size());
+	prep_map_init(s.upmap, ctx.out_size, s.roidim.size());
+	// the scene content moved within the model input
+	s.denoise_acc.release();
+}
+
+// Choose the ROI for the next inference: a padded box around the person
+// in the last mask, or the fixed ROI to (re)detect people
+static void track_roi(backscrub_ctx_t &ctx, stream_t &s) {
+	cv::Rect roi;
+	if (++s.roi_age < ctx.roi_redetect) {
+		cv::Rect bbox = roi_person_bbox(s.ofinal, s.roidim);
+		if (!bbox.empty())
+			roi = roi_around(bbox, ctx.ratio, cv::Size(s.full_roidim.width/3, s.full_roidim.height/3), s.size);
+	}
+	if (roi.empty()) {
+		s.roi_age = 0;
+		set_roi(ctx, s, s.full_roidim, s.full_in_roidim);
+		return;
+	}
+	// keep the current ROI while it still fits snugly, avoids resampling
+	// the temporal mask on every frame
+	if (s.roidim != s.full_roidim && (s.roidim & roi) == roi && s.roidim.area() <= 2 * roi.area())
+		return;
+	set_roi(ctx, s, roi, cv::Rect(0, 0, ctx.in_size.width, ctx.in_size.height));
+}
+
+// Resize the input tensor batch dimension (tensor buffers move!)
+static bool set_batch(backscrub_ctx_t &ctx, engine_t &e, size_t n) {
+	if (e.guides.size() < n)
+		e.guides.resize(n);
+	if (n == e.batch)
+		return true;
+	int in = e.interpreter->inputs()[0];
+	std::vector<int> dims = { (int)n, ctx.in_size.height, ctx.in_size.width, 3 };
+	if (e.interpreter->ResizeInputTensor(in, dims) != kTfLiteOk ||
+		e.interpreter->AllocateTensors() != kTfLiteOk) {
+		_dbg(ctx, "error: unable to resize input to batch of %zu\n", n);
+		return false;
+	}
+	cv::Size in_size, out_size;
+	e.input = getTensorMat(ctx, *e.interpreter, in, ctx.in_fmt, in_size);
+	e.output = getTensorMat(ctx, *e.interpreter, e.interpreter->outputs()[0], ctx.out_fmt, out_size);
+	if (e.input.empty() || e.output.empty() || e.output.rows != (int)n*ctx.out_size.height) {
+		_dbg(ctx, "error: model output does not follow input batch of %zu\n", n);
+		return false;
+	}
+	e.batch = n;
+	// fresh tensor buffers, borders are unknown
+	e.input_roidim.assign(e.guides.size(), cv::Rect());
+	if (e.delegate && &e == &ctx.engines[0])
+		update_xnnpack_info(*e.interpreter, ctx.delegate_info);
+	return true;
 }
 
 // Determine type of model from the name
@@ -158,10 +414,83 @@ static const std::vector<std::string> labels = { "background", "aeroplane", "bic
 static const size_t cnum = labels.size();
 static const size_t pers = std::distance(labels.begin(), std::find(labels.begin(),labels.end(),"person"));
 
+// Build an interpreter of the loaded model with its delegate, tensors and
+// scratch buffers. The first engine determines tensor formats and sizes,
+// the others are identical.
+static bool init_engine(backscrub_ctx_t &ctx, engine_t &e, const bs_maskgen_opts_t &opts) {
+	bool first = &e == &ctx.engines[0];
+	// Build the interpreter, without any implicit delegate - we apply our own below
+	tflite::ops::builtin::BuiltinOpResolverWithoutDefaultDelegates resolver;
+	// custom op for Google Meet network
+	resolver.AddCustom("Convolution2DTransposeBias", mediapipe::tflite_operations::RegisterConvolution2DTransposeBias());
+	tflite::InterpreterBuilder builder(*ctx.model, resolver);
+	builder(&e.interpreter);
+	if (!e.interpreter) {
+		_dbg(ctx, "error: unable to build model interpreter\n");
+		return false;
+	}
+
+	// set interpreter params before any delegate or tensor allocation sees them
+	e.interpreter->SetNumThreads(opts.threads);
+	e.interpreter->SetAllowFp16PrecisionForFp32(opts.fp16);
+
+	// apply XNNPACK delegate and report coverage (once)
+	std::string err;
+	bs_delegate_info_t info;
+	e.delegate = apply_xnnpack(*e.interpreter, opts, info, err);
+	if (info.active) {
+		if (first)
+			_dbg(ctx, "xnnpack: %zu of %zu nodes delegated in %zu partition(s), %zu on reference kernels\n",
+				info.delegated, info.nodes, info.partitions, info.nodes - info.delegated);
+	} else if (opts.xnnpack) {
+		_dbg(ctx, "%s: %s\n", opts.require_xnnpack ? "error" : "warning", err.c_str());
+		if (opts.require_xnnpack)
+			return false;
+	}
+	if (first)
+		ctx.delegate_info = info;
+
+	// Allocate tensor buffers.
+	if (e.interpreter->AllocateTensors() != kTfLiteOk) {
+		_dbg(ctx, "error: unable to allocate tensor buffers\n");
+		return false;
+	}
+
+	// get input and output tensor as cv::Mat
+	tensor_fmt_t in_fmt, out_fmt;
+	cv::Size in_size, out_size;
+	e.input = getTensorMat(ctx, *e.interpreter, e.interpreter->inputs ()[0], in_fmt, in_size);
+	e.output = getTensorMat(ctx, *e.interpreter, e.interpreter->outputs()[0], out_fmt, out_size);
+	if (e.input.empty() || e.output.empty())
+		return false;
+	if (e.input.channels() != 3) {
+		_dbg(ctx, "error: model input is not RGB (%d channels)\n", e.input.channels());
+		return false;
+	}
+	if (first) {
+		ctx.in_fmt = in_fmt;
+		ctx.out_fmt = out_fmt;
+		ctx.in_size = in_size;
+		ctx.out_size = out_size;
+	}
+	e.batch = e.input.rows / in_size.height;
+	e.guides.resize(e.batch);
+	e.input_roidim.assign(e.batch, cv::Rect());
+
+	// model input starts out as normalized black, so letterbox borders stay correct
+	e.prep = cv::Mat(in_size, CV_32FC3, cv::Scalar::all(ctx.norm.offset));
+	// float scratch buffers for non-float32 input/output tensors
+	if (elem_t::F32 != in_fmt.type)
+		e.filtered = cv::Mat(in_size, CV_32FC3);
+	if (elem_t::F16 == out_fmt.type)
+		e.outf = cv::Mat(out_size, CV_32FC(e.output.channels()));
+	return true;
+}
+
 void *bs_maskgen_new(
 	// Required parameters
 	const std::string& modelname,
-	size_t threads,
+	const bs_maskgen_opts_t& opts,
 	size_t width,
 	size_t height,
 	// Optional (nullable) callbacks with caller-provided context
@@ -186,6 +515,7 @@ void *bs_maskgen_new(
 	ctx.oninfer = oninfer;
 	ctx.onmask = onmask;
 	ctx.caller_ctx = caller_ctx;
+	ctx.pool = bs_pool_new();
 	// Load model
 	ctx.model = tflite::FlatBufferModel::BuildFromFile(modelname.c_str());
 	if (!ctx.model) {
@@ -201,143 +531,187 @@ void *bs_maskgen_new(
 		bs_maskgen_delete(pctx);
 		return nullptr;
 	}
-	// Build the interpreter
-	tflite::ops::builtin::BuiltinOpResolver resolver;
-	// custom op for Google Meet network
-	resolver.AddCustom("Convolution2DTransposeBias", mediapipe::tflite_operations::RegisterConvolution2DTransposeBias());
-	tflite::InterpreterBuilder builder(*ctx.model, resolver);
-	builder(&ctx.interpreter);
-	if (!ctx.interpreter) {
-		_dbg(ctx, "error: unable to build model interpreter\n");
-		bs_maskgen_delete(pctx);
-		return nullptr;
+	// Build the interpreter(s), pipelining needs one per frame in flight
+	ctx.engines.resize(std::max((size_t)1, opts.interpreters));
+	for (auto &e : ctx.engines) {
+		if (!init_engine(ctx, e, opts)) {
+			bs_maskgen_delete(pctx);
+			return nullptr;
+		}
 	}
 
-	// Allocate tensor buffers.
-	if (ctx.interpreter->AllocateTensors() != kTfLiteOk) {
-		_dbg(ctx, "error: unable to allocate tensor buffers\n");
-		bs_maskgen_delete(pctx);
-		return nullptr;
-	}
+	_dbg(ctx, "simd: %s\n", simd_name(simd_level()));
+	ctx.ratio = (float)ctx.in_size.height/(float) ctx.in_size.width;
 
-	// set interpreter params
-	ctx.interpreter->SetNumThreads(threads);
-	ctx.interpreter->SetAllowFp16PrecisionForFp32(true);
+	// first stream at the requested frame geometry
+	ctx.streams.resize(1);
+	init_stream(ctx, ctx.streams[0], width, height);
 
-	// get input and output tensor as cv::Mat
-	ctx.input = getTensorMat(ctx, ctx.interpreter->inputs ()[0]);
-	ctx.output = getTensorMat(ctx, ctx.interpreter->outputs()[0]);
-	if (ctx.input.empty() || ctx.output.empty()) {
-		bs_maskgen_delete(pctx);
-		return nullptr;
-	}
-	ctx.ratio = (float)ctx.input.rows/(float) ctx.input.cols;
-	ctx.frameratio = (float)height/(float)width;
+	ctx.denoise = opts.denoise;
 
-	// initialize mask and model-aspect ROI in center
-	if (ctx.frameratio < ctx.ratio) {
-		// if frame is wider than model, then use only the frame center
-		ctx.roidim = cv::Rect((width-height/ctx.ratio)/2,0,height/ctx.ratio,height);
-		ctx.in_roidim = cv::Rect(0, 0, ctx.input.cols, ctx.input.rows);
-	} else {
-		// if model is wider than the frame, center the frame in the model
-		ctx.roidim = cv::Rect(0, 0, width, height);
-		ctx.in_roidim = cv::Rect((ctx.input.cols-ctx.input.rows/ctx.frameratio)/2, 0, ctx.input.rows/ctx.frameratio,ctx.input.rows);
-	}
+	// person ROI tracking
+	ctx.roi_tracking = opts.roi_tracking;
+	ctx.roi_redetect = std::max((size_t)1, opts.roi_redetect);
 
-	ctx.mask = cv::Mat::ones(height,width,CV_8UC1)*255;
-	ctx.mroi = ctx.mask(ctx.roidim);
+	// motion gating
+	ctx.gate_threshold = opts.motion_gate;
+	ctx.gate_max_skip = opts.motion_max_skip;
 
-	ctx.in_u8_bgr = cv::Mat(ctx.input.rows, ctx.input.cols, CV_8UC3, cv::Scalar(0, 0, 0));
+	return pctx;
+}
+
+void *bs_maskgen_new(
+	const std::string& modelname,
+	size_t threads,
+	size_t width,
+	size_t height,
+	void (*ondebug)(void *ctx, const char *msg),
+	void (*onprep)(void *ctx),
+	void (*oninfer)(void *ctx),
+	void (*onmask)(void *ctx),
+	void *caller_ctx
+) {
+	bs_maskgen_opts_t opts;
+	opts.threads = threads;
+	return bs_maskgen_new(modelname, opts, width, height, ondebug, onprep, oninfer, onmask, caller_ctx);
+}
 
-	// mask blurring size
-	ctx.blur = cv::Size(5,5);
+bool bs_maskgen_stats(void *context, bs_maskgen_stats_t &stats) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	std::lock_guard<std::mutex> hold(ctx.stats_lock);
+	stats = ctx.stats;
+	return true;
+}
 
-	// create Mat for small mask
-	ctx.ofinal = cv::Mat(ctx.output.rows,ctx.output.cols,CV_8UC1);
-	return pctx;
+bool bs_maskgen_delegate_info(void *context, bs_delegate_info_t &info) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	info = ctx.delegate_info;
+	return true;
 }
 
+static void async_stop(backscrub_ctx_t &ctx);
+
 void bs_maskgen_delete(void *context) {
 	if (!context)
 		return;
 	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	// stop the worker (if any), dropping pending frames
+	async_stop(ctx);
 	// clear all mask data
-	ctx.ofinal.deallocate();
-	ctx.mask.deallocate();
-	ctx.input.deallocate();
-	ctx.output.deallocate();
-	// drop interpreter (if present)
-	if (ctx.interpreter != nullptr)
-		ctx.interpreter.reset();
+	ctx.streams.clear();
+	// drop interpreters (if present), each before its delegate
+	ctx.engines.clear();
+	bs_pool_delete(ctx.pool);
 	// drop model (if present)
 	if (ctx.model != nullptr)
 		ctx.model.reset();
 	delete &ctx;
 }
 
-bool bs_maskgen_process(void *context, cv::Mat &frame, cv::Mat &mask) {
-	if (!context)
-		return false;
-	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+// Nanoseconds elapsed since t0
+static long elapsed_ns(std::chrono::steady_clock::time_point t0) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+}
 
-	// map ROI
-	cv::Mat roi = frame(ctx.roidim);
+// Noise reduction of the prepared frame (e.prep) into dst, returns the
+// result, which is e.prep itself when there is nothing to do
+static const cv::Mat &denoise(backscrub_ctx_t &ctx, engine_t &e, stream_t &s, cv::Mat &dst) {
+	// range parameters are in 8-bit pixel values, scaled into input units
+	switch (ctx.denoise) {
+		case bs_denoise_t::None:
+			return e.prep;
+		case bs_denoise_t::Gaussian:
+			cv::GaussianBlur(e.prep, dst, cv::Size(3, 3), 0);
+			break;
+		case bs_denoise_t::FastBilateral:
+			denoise_bilateral_sep(e.prep, dst, 100.0f*ctx.norm.scaling, e.denoise_tmp);
+			break;
+		case bs_denoise_t::Temporal:
+			denoise_temporal(e.prep, s.denoise_acc, 0.5f, 24.0f*ctx.norm.scaling, dst);
+			break;
+		case bs_denoise_t::Bilateral:
+		default:
+			cv::bilateralFilter(e.prep, dst, 5, 100.0*ctx.norm.scaling, 100.0);
+			break;
+	}
+	return dst;
+}
 
-	cv::Mat in_u8_rgb;
-	cv::Mat in_roi = ctx.in_u8_bgr(ctx.in_roidim);
-	cv::resize(roi,in_roi,ctx.in_roidim.size());
-	cv::cvtColor(ctx.in_u8_bgr,in_u8_rgb,cv::COLOR_BGR2RGB);
+// Prepare one frame into batch item b of the input tensor, sampled from yuv
+// instead if given (frame is its luma then). Returns the noise reduction time.
+static long prep_frame(backscrub_ctx_t &ctx, engine_t &e, stream_t &s, cv::Mat &frame, const prep_yuv_t *yuv, size_t b) {
+	// without noise reduction a float32 input tensor is prepared in place,
+	// filters need the scratch buffer as their separate source
+	cv::Mat input = e.input.rowRange(b*ctx.in_size.height, (b+1)*ctx.in_size.height);
+	bool direct = bs_denoise_t::None == ctx.denoise && elem_t::F32 == ctx.in_fmt.type;
+	cv::Mat &prep = direct ? input : e.prep;
+	cv::Rect &prep_roidim = direct ? e.input_roidim[b] : e.prep_roidim;
+	// letterbox borders differ between streams of different aspect
+	if (prep_roidim != s.in_roidim) {
+		prep = cv::Scalar::all(ctx.norm.offset);
+		prep_roidim = s.in_roidim;
+	}
 
-	// TODO: can convert directly to float?
+	// single pass crop, resize, BGR->RGB & normalize
+	cv::Mat in_roi = prep(s.in_roidim);
+	if (yuv)
+		prep_yuv_to_rgbf(s.prepmap, *yuv, s.roidim.tl(), in_roi, ctx.norm.scaling, ctx.norm.offset);
+	else
+		prep_bgr_to_rgbf(s.prepmap, frame(s.roidim), in_roi, ctx.norm.scaling, ctx.norm.offset);
+	// low resolution guide for mask upsampling, Y'CbCr frames are later
+	// upsampled against their own luma so use the same weights
+	if (yuv)
+		gf_guide(in_roi, ctx.norm.scaling, ctx.norm.offset, ctx.out_size, e.guides[b], e.guide_tmp, yuv->kr, yuv->kb);
+	else
+		gf_guide(in_roi, ctx.norm.scaling, ctx.norm.offset, ctx.out_size, e.guides[b], e.guide_tmp);
 
-	// bilateral filter to reduce noise
-	if (1) {
-		cv::Mat filtered;
-		cv::bilateralFilter(in_u8_rgb,filtered,5,100.0,100.0);
-		in_u8_rgb = filtered;
-	}
+	if (direct)
+		return 0;
+	// the filter overwrites the whole batch item
+	e.input_roidim[b] = cv::Rect();
 
-	// convert to float and normalize values expected by the model
-	in_u8_rgb.convertTo(ctx.input,CV_32FC3,ctx.norm.scaling,ctx.norm.offset);
-	if (ctx.onprep)
-		ctx.onprep(ctx.caller_ctx);
+	// reduce noise, landing directly in a float32 input tensor
+	auto t0 = std::chrono::steady_clock::now();
+	const cv::Mat &clean = denoise(ctx, e, s, elem_t::F32 == ctx.in_fmt.type ? input : e.filtered);
+	long ns = elapsed_ns(t0);
+	if (elem_t::F32 != ctx.in_fmt.type)
+		prep_store(clean, input, ctx.in_fmt);
+	return ns;
+}
 
-	// Run inference
-	if (ctx.interpreter->Invoke() != kTfLiteOk) {
-		_dbg(ctx, "error: failed to interpret video frame\n");
-		return false;
+// Fold batch item b of the output tensor into the stream temporal mask
+static bool mask_frame(backscrub_ctx_t &ctx, engine_t &e, stream_t &s, size_t b) {
+	cv::Mat output = e.output.rowRange(b*ctx.out_size.height, (b+1)*ctx.out_size.height);
+	const float* tmp = (const float*)output.data;
+	uint8_t* out = (uint8_t*)s.ofinal.data;
+	size_t n = output.total();
+	// 8-bit outputs are compared in the quantized domain, halfs widened first
+	bool q8 = elem_t::U8 == ctx.out_fmt.type || elem_t::I8 == ctx.out_fmt.type;
+	if (elem_t::F16 == ctx.out_fmt.type) {
+		post_widen_f16((const uint16_t*)output.data, n * output.channels(), (float*)e.outf.data);
+		tmp = (const float*)e.outf.data;
 	}
-	if (ctx.oninfer)
-		ctx.oninfer(ctx.caller_ctx);
-
-	float* tmp = (float*)ctx.output.data;
-	uint8_t* out = (uint8_t*)ctx.ofinal.data;
 
 	switch (ctx.modeltype) {
 		case modeltype_t::DeepLab:
-			// find class with maximum probability
-			for (unsigned int n = 0; n < ctx.output.total(); n++) {
-				float maxval = -10000; size_t maxpos = 0;
-				for (size_t i = 0; i < cnum; i++) {
-					if (tmp[n*cnum+i] > maxval) {
-						maxval = tmp[n*cnum+i];
-						maxpos = i;
-					}
-				}
-				// set mask to 0 where class == person
-				uint8_t val = (maxpos==pers ? 0 : 255);
-				out[n] = (val & 0xE0) | (out[n] >> 3);
-			}
+			// find class with maximum probability, mask is 0 where class == person
+			if (q8)
+				post_argmax_q8(output.data, ctx.out_fmt, n, cnum, pers, out);
+			else
+				post_argmax(tmp, n, cnum, pers, out);
 			break;
 		case modeltype_t::BodyPix:
 		case modeltype_t::MLKitSelfie:
 			// threshold probability
-			for (unsigned int n = 0; n < ctx.output.total(); n++) {
-				// FIXME: hardcoded threshold
-				uint8_t val = (tmp[n] > 0.65 ? 0 : 255);
-				out[n] = (val & 0xE0) | (out[n] >> 3);
-			}
+			// FIXME: hardcoded threshold
+			if (q8)
+				post_threshold_q8(output.data, ctx.out_fmt, n, 0.65f, out);
+			else
+				post_threshold(tmp, n, 0.65f, out);
 			break;
 		case modeltype_t::GoogleMeetSegmentation:
 			/* 256 x 144 x 2 tensor for the full model or 160 x 96 x 2
@@ -345,37 +719,572 @@ bool bs_maskgen_process(void *context, cv::Mat &frame, cv::Mat &mask) {
 			 * (channel 0) and person (channel 1) where values are in
 			 * range [MIN_FLOAT, MAX_FLOAT] and user has to apply
 			 * softmax across both channels to yield foreground
-			 * probability in [0.0, 1.0]. */
-			for (unsigned int n = 0; n < ctx.output.total(); n++) {
-				float exp0 = expf(tmp[2*n  ]);
-				float exp1 = expf(tmp[2*n+1]);
-				float p0 = exp0 / (exp0+exp1);
-				float p1 = exp1 / (exp0+exp1);
-				uint8_t val = (p0 < p1 ? 0 : 255);
-				out[n] = (val & 0xE0) | (out[n] >> 3);
-			}
+			 * probability in [0.0, 1.0]. Only the comparison matters,
+			 * so we compare the logits directly. */
+			if (q8)
+				post_softmax2_q8(output.data, ctx.out_fmt, n, out);
+			else
+				post_softmax2(tmp, n, out);
 			break;
 		case modeltype_t::Unknown:
 			_dbg(ctx, "error: unknown model type (%d)\n", ctx.modeltype);
 			return false;
 	}
+	return true;
+}
+
+// Fit the guided filter coefficients of the stream temporal mask, into other
+// (pooled) buffers as callers may still hold the previous low resolution mask
+static void fit_mask(backscrub_ctx_t &ctx, stream_t &s, const cv::Mat &guide) {
+	bs_pool_get(ctx.pool, guide.size(), CV_32FC1, s.gf_a);
+	bs_pool_get(ctx.pool, guide.size(), CV_32FC1, s.gf_b);
+	gf_coeffs(guide, s.ofinal, s.gf_a, s.gf_b, s.gf_tmp);
+	s.mask_valid = false;
+}
+
+// Render the coefficients into the full-sized mask, guided by the frame so
+// mask edges follow image edges
+static void upscale_mask(stream_t &s, cv::Mat &frame) {
+	// NB: the whole small mask covers the ROI (also when letterboxed), as
+	// with body-pix-float-050-8.tflite the mask is 33x33 and in_roidim
+	// need not fit inside it
+	if (!s.mask_valid && !s.gf_a.empty()) {
+		if (frame.type() == CV_8UC3)
+			gf_apply(s.upmap, s.gf_a, s.gf_b, frame(s.roidim), s.mroi);
+		else
+			gf_apply_luma(s.upmap, s.gf_a, s.gf_b, frame(s.roidim), s.mroi);
+	}
+	s.mask_valid = true;
+}
+
+// Hand out the stream mask, full size or low resolution
+static void output_mask(stream_t &s, cv::Mat &frame, cv::Mat *masks, bs_lowres_mask_t *lowres, size_t b) {
+	if (lowres) {
+		lowres[b].size = s.size;
+		lowres[b].roi = s.roidim;
+		lowres[b].a = s.gf_a;
+		lowres[b].b = s.gf_b;
+	} else {
+		upscale_mask(s, frame);
+		masks[b] = s.mask;
+	}
+}
 
+// Motion gating: true if no stream changed enough since its last inference
+// (and none is due a refresh), so all can reuse their previous masks
+static bool gate_frames(backscrub_ctx_t &ctx, cv::Mat *frames, size_t count) {
+	bool skip = true;
+	for (size_t b = 0; b < count; b++) {
+		stream_t &s = ctx.streams[b];
+		motion_signature(frames[b], s.gate_cur);
+		if (s.gate_ref.empty() || s.gate_ref.size() != s.gate_cur.size() ||
+			s.gate_skipped >= ctx.gate_max_skip ||
+			motion_changed(s.gate_ref, s.gate_cur) >= ctx.gate_threshold)
+			skip = false;
+	}
+	for (size_t b = 0; b < count; b++) {
+		stream_t &s = ctx.streams[b];
+		if (skip) {
+			s.gate_skipped++;
+		} else {
+			// compare against this (inferred) frame from now on
+			std::swap(s.gate_ref, s.gate_cur);
+			s.gate_skipped = 0;
+		}
+	}
+	return skip;
+}
+
+// Pre-processing stage: set up stream state and prepare the frames into the
+// input tensor of e, or set gated when motion gating reuses the previous masks.
+// Y'CbCr frames come as yuv, with their luma views in frames.
+static bool prep_stage(backscrub_ctx_t &ctx, engine_t &e, cv::Mat *frames, size_t count, bool &gated,
+	const prep_yuv_t *yuv = nullptr) {
+	auto t0 = std::chrono::steady_clock::now();
+	gated = false;
+	if (!count || !set_batch(ctx, e, count))
+		return false;
+	if (ctx.streams.size() < count)
+		ctx.streams.resize(count);
+	for (size_t b = 0; b < count; b++) {
+		stream_t &s = ctx.streams[b];
+		if (s.size != frames[b].size())
+			init_stream(ctx, s, frames[b].cols, frames[b].rows);
+	}
+
+	// static scene: hand out the previous masks, callbacks still fire so
+	// callers see the (near zero) cost of this frame
+	long denoise_ns = 0;
+	if (ctx.gate_threshold > 0 && gate_frames(ctx, frames, count)) {
+		gated = true;
+	} else {
+		for (size_t b = 0; b < count; b++) {
+			if (ctx.roi_tracking)
+				track_roi(ctx, ctx.streams[b]);
+			denoise_ns += prep_frame(ctx, e, ctx.streams[b], frames[b], yuv ? yuv + b : nullptr, b);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> hold(ctx.stats_lock);
+		ctx.stats.frames += count;
+		if (gated)
+			ctx.stats.skipped += count;
+		else
+			ctx.stats.denoise_ns = denoise_ns;
+		ctx.stats.prep_ns = elapsed_ns(t0);
+	}
+	if (ctx.onprep)
+		ctx.onprep(ctx.caller_ctx);
+	return true;
+}
+
+// Inference stage
+static bool infer_stage(backscrub_ctx_t &ctx, engine_t &e, bool gated) {
+	auto t0 = std::chrono::steady_clock::now();
+	if (!gated && e.interpreter->Invoke() != kTfLiteOk) {
+		_dbg(ctx, "error: failed to interpret video frame\n");
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> hold(ctx.stats_lock);
+		ctx.stats.infer_ns = elapsed_ns(t0);
+	}
+	if (ctx.oninfer)
+		ctx.oninfer(ctx.caller_ctx);
+	return true;
+}
+
+// Post-processing stage: fold the model output into the temporal masks, fit
+// upsampling coefficients & copy out (scaled up unless low resolution)
+static bool post_stage(backscrub_ctx_t &ctx, engine_t &e, cv::Mat *frames, cv::Mat *masks, bs_lowres_mask_t *lowres, size_t count, bool gated) {
+	auto t0 = std::chrono::steady_clock::now();
+	if (!gated) {
+		for (size_t b = 0; b < count; b++) {
+			if (!mask_frame(ctx, e, ctx.streams[b], b))
+				return false;
+		}
+	}
 	if (ctx.onmask)
 		ctx.onmask(ctx.caller_ctx);
 
-	// scale up into full-sized mask
-	cv::Mat tmpbuf;
-	// with body-pix-float-050-8.tflite the size of ctx.ofinal is 33x33
-	// and the wanted roi may be greater as 33x33 so we can crash with
-	// cv::resize(ctx.ofinal(ctx.in_roidim),tmpbuf,ctx.mroi.size());
-	ctx.ofinal.copyTo(tmpbuf);
-	cv::resize(tmpbuf, tmpbuf, ctx.mroi.size());
+	for (size_t b = 0; b < count; b++) {
+		if (!gated)
+			fit_mask(ctx, ctx.streams[b], e.guides[b]);
+		output_mask(ctx.streams[b], frames[b], masks, lowres, b);
+	}
+	std::lock_guard<std::mutex> hold(ctx.stats_lock);
+	ctx.stats.post_ns = elapsed_ns(t0);
+	return true;
+}
+
+static bool process(backscrub_ctx_t &ctx, cv::Mat *frames, cv::Mat *masks, bs_lowres_mask_t *lowres, size_t count,
+	const prep_yuv_t *yuv = nullptr) {
+	engine_t &e = ctx.engines[0];
+	bool gated;
+	return prep_stage(ctx, e, frames, count, gated, yuv) &&
+		infer_stage(ctx, e, gated) &&
+		post_stage(ctx, e, frames, masks, lowres, count, gated);
+}
+
+bool bs_maskgen_process(void *context, cv::Mat &frame, cv::Mat &mask) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	std::lock_guard<std::shared_mutex> hold(ctx.busy);
+	return process(ctx, &frame, &mask, nullptr, 1);
+}
+
+bool bs_maskgen_process_batch(void *context, std::vector<cv::Mat> &frames, std::vector<cv::Mat> &masks) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	std::lock_guard<std::shared_mutex> hold(ctx.busy);
+	masks.resize(frames.size());
+	return process(ctx, frames.data(), masks.data(), nullptr, frames.size());
+}
+
+bool bs_maskgen_process_lowres(void *context, std::vector<cv::Mat> &frames, std::vector<bs_lowres_mask_t> &masks) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	std::lock_guard<std::shared_mutex> hold(ctx.busy);
+	masks.resize(frames.size());
+	return process(ctx, frames.data(), nullptr, masks.data(), frames.size());
+}
+
+// Luma view (frame) and sampling description (yuv) of a Y'CbCr frame
+static bool yuv_input(const bs_yuv_frame_t &in, cv::Mat &frame, prep_yuv_t &yuv) {
+	if (in.width <= 0 || in.height <= 0 || (in.width & 1) || (in.height & 1) || !in.y ||
+		in.ystride < (size_t)in.width * (in.nv12 ? 1 : 2) || (in.nv12 && (!in.uv || in.uvstride < (size_t)in.width)))
+		return false;
+	frame = cv::Mat(in.height, in.width, in.nv12 ? CV_8UC1 : CV_8UC2, (void *)in.y, in.ystride);
+	yuv.nv12 = in.nv12;
+	yuv.y = in.y;
+	yuv.ystride = in.ystride;
+	yuv.uv = in.uv;
+	yuv.uvstride = in.uvstride;
+	yuv.kr = bs_yuv_matrix_t::BT709 == in.matrix ? 0.2126f : 0.299f;
+	yuv.kb = bs_yuv_matrix_t::BT709 == in.matrix ? 0.0722f : 0.114f;
+	return true;
+}
+
+bool bs_maskgen_process_yuv(void *context, const bs_yuv_frame_t &frame, cv::Mat &mask) {
+	cv::Mat luma;
+	prep_yuv_t yuv;
+	if (!context || !yuv_input(frame, luma, yuv))
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	std::lock_guard<std::shared_mutex> hold(ctx.busy);
+	return process(ctx, &luma, &mask, nullptr, 1, &yuv);
+}
+
+bool bs_maskgen_process_yuv_lowres(void *context, const bs_yuv_frame_t &frame, bs_lowres_mask_t &mask) {
+	cv::Mat luma;
+	prep_yuv_t yuv;
+	if (!context || !yuv_input(frame, luma, yuv))
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	std::lock_guard<std::shared_mutex> hold(ctx.busy);
+	return process(ctx, &luma, nullptr, &mask, 1, &yuv);
+}
+
+// Worker thread of engine e: frames are prepared one at a time in queue
+// order, inferred concurrently with the other engines, then finished (and
+// delivered) in queue order again
+static void async_run(backscrub_ctx_t &ctx, engine_t &e) {
+	async_t &a = *ctx.async;
+	for (;;) {
+		bs_mask_result_t res;
+		uint64_t ticket;
+		bool gated = false;
+		std::shared_lock<std::shared_mutex> busy(ctx.busy, std::defer_lock);
+		{
+			std::lock_guard<std::mutex> stage(a.prep_stage);
+			std::unique_lock<std::mutex> hold(a.lock);
+			a.wake.wait(hold, [&a] { return a.stop || !a.jobs.empty(); });
+			if (a.stop)
+				return;
+			res.seq = a.jobs.front().seq;
+			res.frame = a.jobs.front().frame;
+			a.jobs.pop_front();
+			ticket = a.taken++;
+			a.running++;
+			// ROI tracking and geometry changes alter the stream state the
+			// frames still in flight are finished with, wait for them
+			if (ctx.roi_tracking || ctx.streams[0].size != res.frame.size())
+				a.turn.wait(hold, [&a, ticket] { return a.stop || a.finished == ticket; });
+			if (a.stop)
+				return;
+			hold.unlock();
+			busy.lock();
+			res.ok = prep_stage(ctx, e, &res.frame, 1, gated);
+		}
+		if (res.ok)
+			res.ok = infer_stage(ctx, e, gated);
+		{
+			std::unique_lock<std::mutex> hold(a.lock);
+			a.turn.wait(hold, [&a, ticket] { return a.stop || a.finished == ticket; });
+			if (a.stop)
+				return;
+		}
+		if (res.ok) {
+			cv::Mat mask;
+			res.ok = post_stage(ctx, e, &res.frame, &mask, a.lowres ? &res.lowres : nullptr, 1, gated);
+			// the stream mask is overwritten by the next frame
+			if (res.ok && !a.lowres && bs_pool_get(ctx.pool, mask.size(), mask.type(), res.mask))
+				mask.copyTo(res.mask);
+		}
+		busy.unlock();
+		if (a.ondone)
+			a.ondone(ctx.caller_ctx, res);
+		std::lock_guard<std::mutex> hold(a.lock);
+		a.finished++;
+		a.running--;
+		if (!a.ondone)
+			a.results.push_back(std::move(res));
+		a.turn.notify_all();
+		a.done.notify_all();
+	}
+}
+
+static void async_stop(backscrub_ctx_t &ctx) {
+	if (!ctx.async)
+		return;
+	{
+		std::lock_guard<std::mutex> hold(ctx.async->lock);
+		ctx.async->stop = true;
+	}
+	ctx.async->wake.notify_all();
+	ctx.async->turn.notify_all();
+	ctx.async->done.notify_all();
+	for (auto &worker : ctx.async->workers)
+		worker.join();
+	ctx.async.reset();
+}
+
+bool bs_maskgen_async(void *context, size_t depth, bool lowres, void (*ondone)(void *ctx, bs_mask_result_t &result)) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	if (ctx.async) {
+		_dbg(ctx, "error: asynchronous processing already started\n");
+		return false;
+	}
+	ctx.async.reset(new async_t);
+	async_t &a = *ctx.async;
+	a.depth = std::max((size_t)1, depth);
+	a.running = 0;
+	a.taken = a.finished = 0;
+	a.lowres = lowres;
+	a.stop = false;
+	a.ondone = ondone;
+	for (auto &e : ctx.engines)
+		a.workers.emplace_back(async_run, std::ref(ctx), std::ref(e));
+	return true;
+}
+
+bool bs_maskgen_submit(void *context, cv::Mat &frame, uint64_t seq) {
+	if (!context || frame.empty())
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	if (!ctx.async && !bs_maskgen_async(context, 2, false, nullptr))
+		return false;
+	async_t &a = *ctx.async;
+	{
+		std::lock_guard<std::mutex> hold(a.lock);
+		if (a.jobs.size() + a.results.size() + a.running >= a.depth)
+			return false;
+		a.jobs.push_back({ seq, frame });
+	}
+	a.wake.notify_one();
+	return true;
+}
+
+bool bs_maskgen_poll(void *context, bs_mask_result_t &result, bool wait) {
+	if (!context)
+		return false;
+	backscrub_ctx_t &ctx = *((backscrub_ctx_t *)context);
+	if (!ctx.async)
+		return false;
+	async_t &a = *ctx.async;
+	std::unique_lock<std::mutex> hold(a.lock);
+	if (wait)
+		a.done.wait(hold, [&a] { return a.stop || !a.results.empty() || (a.jobs.empty() && !a.running); });
+	if (a.results.empty())
+		return false;
+	result = std::move(a.results.front());
+	a.results.pop_front();
+	return true;
+}
+
+// Usable low resolution mask for a frame
+static bool lowres_valid(const bs_lowres_mask_t &mask, const cv::Mat &frame) {
+	return !mask.a.empty() && mask.a.size() == mask.b.size() && mask.size == frame.size() &&
+		(mask.roi & cv::Rect(0, 0, frame.cols, frame.rows)) == mask.roi;
+}
+
+// Coefficient sampling tables for a low resolution mask, (re)built when the
+// geometry changed
+static void lowres_map(const bs_lowres_mask_t &mask, prep_map_t &map) {
+	if (map.ssize != mask.a.size() || map.dsize != mask.roi.size())
+		prep_map_init(map, mask.a.size(), mask.roi.size());
+}
+
+// Blend rows [y0, y1) of bg over fg with a (valid) low resolution mask into
+// dst (y1 - y0 rows), map holding its sampling tables (see lowres_map)
+static void composite_rows(const bs_lowres_mask_t &mask, const prep_map_t &map, cv::Mat &bg, cv::Mat &fg, int y0, int y1, cv::Mat &dst) {
+	const cv::Rect &r = mask.roi;
+	const int r0 = std::max(y0, r.y), r1 = std::min(y1, r.y + r.height);
+	if (r0 >= r1) {
+		bg.rowRange(y0, y1).copyTo(dst);
+		return;
+	}
+	// background outside the mask region
+	cv::Rect outside[] = {
+		cv::Rect(0, y0, fg.cols, r0 - y0),
+		cv::Rect(0, r1, fg.cols, y1 - r1),
+		cv::Rect(0, r0, r.x, r1 - r0),
+		cv::Rect(r.x + r.width, r0, fg.cols - r.x - r.width, r1 - r0),
+	};
+	for (const cv::Rect &o : outside) {
+		if (o.area() > 0) {
+			cv::Mat d = dst(cv::Rect(o.x, o.y - y0, o.width, o.height));
+			bg(o).copyTo(d);
+		}
+	}
+	cv::Mat d = dst(cv::Rect(r.x, r0 - y0, r.width, r1 - r0));
+	gf_blend_rows(map, mask.a, mask.b, fg(r), bg(r), r0 - r.y, r1 - r.y, d);
+}
+
+bool bs_composite(const bs_lowres_mask_t &mask, cv::Mat &bg, cv::Mat &fg, cv::Mat &out) {
+	if (fg.type() != CV_8UC3 || bg.type() != CV_8UC3 || bg.size() != fg.size())
+		return false;
+	out.create(fg.size(), CV_8UC3);
+	if (!lowres_valid(mask, fg)) {
+		bg.copyTo(out);
+		return true;
+	}
+	// sampling tables of the last geometry, per calling thread (pipeline)
+	static thread_local prep_map_t map;
+	lowres_map(mask, map);
+	composite_rows(mask, map, bg, fg, 0, fg.rows, out);
+	return true;
+}
+
+bool bs_alpha_blend(cv::Mat &mask, cv::Mat &bg, cv::Mat &fg, cv::Mat &out) {
+	if (fg.type() != CV_8UC3 || bg.type() != CV_8UC3 || mask.type() != CV_8UC1 ||
+		bg.size() != fg.size() || mask.size() != fg.size())
+		return false;
+	out.create(fg.size(), CV_8UC3);
+	if (mask.isContinuous() && bg.isContinuous() && fg.isContinuous() && out.isContinuous()) {
+		blend_bgr(bg.data, fg.data, mask.data, fg.total(), out.data);
+		return true;
+	}
+	for (int y = 0; y < fg.rows; y++)
+		blend_bgr(bg.ptr<uint8_t>(y), fg.ptr<uint8_t>(y), mask.ptr<uint8_t>(y), fg.cols, out.ptr<uint8_t>(y));
+	return true;
+}
+
+static const yuv_coeffs_t &yuv_coeffs(bs_yuv_matrix_t matrix) {
+	return bs_yuv_matrix_t::BT709 == matrix ? yuv_bt709 : yuv_bt601;
+}
+
+bool bs_bgr_to_yuyv(cv::Mat &bgr, bs_yuv_matrix_t matrix, uint8_t *out, size_t stride) {
+	if (bgr.type() != CV_8UC3 || (bgr.cols & 1) || !out || stride < 2 * (size_t)bgr.cols)
+		return false;
+	const yuv_coeffs_t &k = yuv_coeffs(matrix);
+	for (int y = 0; y < bgr.rows; y++)
+		yuv_yuyv_row(bgr.ptr<uint8_t>(y), bgr.cols, k, out + y * stride);
+	return true;
+}
+
+bool bs_bgr_to_nv12(cv::Mat &bgr, bs_yuv_matrix_t matrix, uint8_t *y, size_t ystride, uint8_t *uv, size_t uvstride) {
+	if (bgr.type() != CV_8UC3 || (bgr.cols & 1) || (bgr.rows & 1) || !y || !uv ||
+		ystride < (size_t)bgr.cols || uvstride < (size_t)bgr.cols)
+		return false;
+	const yuv_coeffs_t &k = yuv_coeffs(matrix);
+	for (int r = 0; r < bgr.rows; r += 2)
+		yuv_nv12_rows(bgr.ptr<uint8_t>(r), bgr.ptr<uint8_t>(r + 1), bgr.cols, k,
+			y + r * ystride, y + (r + 1) * ystride, uv + (r / 2) * uvstride);
+	return true;
+}
+
+size_t bs_output_stride(bs_pixfmt_t format, size_t width) {
+	switch (format) {
+	case bs_pixfmt_t::NV12:
+		return width;
+	case bs_pixfmt_t::I420:
+		// chroma rows at half the stride must stay whole
+		return (width + 1) & ~(size_t)1;
+	case bs_pixfmt_t::RGB24:
+		return 3 * width;
+	default:
+		return 2 * width;
+	}
+}
+
+size_t bs_output_bytes(bs_pixfmt_t format, size_t height, size_t stride) {
+	if (bs_pixfmt_t::NV12 == format || bs_pixfmt_t::I420 == format)
+		return stride * height * 3 / 2;
+	return stride * height;
+}
 
-	// blur at full size for maximum smoothness
-	cv::blur(tmpbuf,ctx.mroi,ctx.blur);
+static compose_format_t compose_format(bs_pixfmt_t format) {
+	switch (format) {
+	case bs_pixfmt_t::NV12:
+		return compose_format_t::NV12;
+	case bs_pixfmt_t::I420:
+		return compose_format_t::I420;
+	case bs_pixfmt_t::RGB24:
+		return compose_format_t::RGB24;
+	default:
+		return compose_format_t::YUYV;
+	}
+}
+
+struct compose_ctx_t {
+	compose_t stripes;
+	// low resolution mask sampling tables
+	prep_map_t lowres;
+};
 
-	// copy out
-	mask = ctx.mask;
+void *bs_workers_new(size_t threads) {
+	return workers_new(threads);
+}
+
+void bs_workers_delete(void *workers) {
+	workers_delete((workers_t *)workers);
+}
+
+void bs_workers_run(void *workers, size_t tasks, const std::function<void(size_t)> &task) {
+	workers_run((workers_t *)workers, tasks, task);
+}
+
+void *bs_compose_new(void *workers) {
+	compose_ctx_t *ctx = new compose_ctx_t;
+	ctx->stripes.workers = (workers_t *)workers;
+	return ctx;
+}
+
+void bs_compose_delete(void *context) {
+	delete (compose_ctx_t *)context;
+}
+
+bool bs_compose(void *context, const bs_output_t &output, const cv::Mat *mask, const bs_lowres_mask_t *lmask,
+	cv::Mat &bg, cv::Mat &fg, uint8_t *out, size_t stride) {
+	if (!context || fg.type() != CV_8UC3 || fg.empty() || !out)
+		return false;
+	if ((mask || lmask) && (bg.type() != CV_8UC3 || bg.size() != fg.size()))
+		return false;
+	if (mask && (mask->type() != CV_8UC1 || mask->size() != fg.size()))
+		return false;
+	const cv::Size size = output.size.empty() ? fg.size() : output.size;
+	const bool yuv = bs_pixfmt_t::RGB24 != output.format;
+	const bool planar = bs_pixfmt_t::NV12 == output.format || bs_pixfmt_t::I420 == output.format;
+	if ((yuv && (size.width & 1)) || (planar && (size.height & 1)) ||
+		stride < bs_output_stride(output.format, size.width) || (bs_pixfmt_t::I420 == output.format && (stride & 1)))
+		return false;
+	compose_ctx_t &ctx = *((compose_ctx_t *)context);
+	compose_out_t o;
+	o.size = size;
+	o.flip_h = output.flip_h;
+	o.flip_v = output.flip_v;
+	o.format = compose_format(output.format);
+	o.coeffs = &yuv_coeffs(output.matrix);
+	o.data = out;
+	o.stride = stride;
+	compose_blend_t blend;
+	if (mask) {
+		blend = [&](int y0, int y1, cv::Mat &dst) {
+			for (int y = y0; y < y1; y++)
+				blend_bgr(bg.ptr<uint8_t>(y), fg.ptr<uint8_t>(y), mask->ptr<uint8_t>(y), fg.cols, dst.ptr<uint8_t>(y - y0));
+		};
+	} else if (lmask && lowres_valid(*lmask, fg)) {
+		lowres_map(*lmask, ctx.lowres);
+		blend = [&](int y0, int y1, cv::Mat &dst) {
+			composite_rows(*lmask, ctx.lowres, bg, fg, y0, y1, dst);
+		};
+	} else if (lmask) {
+		// no mask for this frame size (yet): all background
+		blend = [&](int y0, int y1, cv::Mat &dst) {
+			bg.rowRange(y0, y1).copyTo(dst);
+		};
+	}
+	compose_frame(ctx.stripes, fg, blend, o);
+	return true;
+}
+
+bool bs_lowres_render(const bs_lowres_mask_t &mask, cv::Mat &frame, cv::Mat &out) {
+	if (frame.type() != CV_8UC3)
+		return false;
+	out.create(frame.size(), CV_8UC1);
+	out.setTo(cv::Scalar(255));
+	if (!lowres_valid(mask, frame))
+		return true;
+	prep_map_t map;
+	prep_map_init(map, mask.a.size(), mask.roi.size());
+	cv::Mat dst = out(mask.roi);
+	gf_apply(map, mask.a, mask.b, frame(mask.roi), dst);
 	return true;
 }
 
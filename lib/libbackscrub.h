@@ -6,13 +6,144 @@
 #define _LIBBACKSCRUB_H
 
 // for cv::Mat and related types
+#include <stdint.h>
+#include <functional>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 // Get Tensorflow version string
 extern const char *bs_tensorflow_version(void);
 
+// Noise reduction applied to the scaled frame before inference
+enum class bs_denoise_t {
+	// none, for clean (eg: well lit) cameras
+	None,
+	// 3x3 Gaussian blur
+	Gaussian,
+	// separable (5 tap horizontal + vertical) approximation of the below
+	FastBilateral,
+	// average with previous frames where the scene did not move
+	Temporal,
+	// 5x5 bilateral filter (cv::bilateralFilter)
+	Bilateral,
+};
+
+// Y'CbCr matrix of the video output (limited range)
+enum class bs_yuv_matrix_t {
+	// ITU-R BT.601, SD and what most consumers assume
+	BT601,
+	// ITU-R BT.709, HD
+	BT709,
+};
+
+// Pixel format of the video output, as single planar V4L2 buffers (planes
+// back to back, starting every stride * rows bytes)
+enum class bs_pixfmt_t {
+	// packed Y'CbCr 4:2:2 (Y0 Cb Y1 Cr), the default
+	YUYV,
+	// Y'CbCr 4:2:0, luma plane and a plane of interleaved Cb Cr
+	NV12,
+	// Y'CbCr 4:2:0, luma, Cb and Cr planes (chroma at half the stride)
+	I420,
+	// packed R G B
+	RGB24,
+};
+
+// Mask generation options
+struct bs_maskgen_opts_t {
+	// number of inference threads (interpreter and delegate)
+	size_t threads = 2;
+	// run supported operators through the XNNPACK delegate (when built in)
+	bool xnnpack = true;
+	// fail context creation unless the XNNPACK delegate was applied
+	bool require_xnnpack = false;
+	// allow reduced (fp16) precision for float32 operators
+	bool fp16 = true;
+	// let XNNPACK take signed/unsigned 8-bit quantized operators too
+	bool quantized = true;
+	// reuse the previous mask instead of running inference while less than
+	// this fraction of a downsampled frame changed since the last inference
+	// (0 disables motion gating)
+	float motion_gate = 0;
+	// refresh the mask after at most this many consecutive reused frames
+	size_t motion_max_skip = 10;
+	// track the person: infer on a padded crop around the previous mask
+	// instead of the fixed centered region of the frame
+	bool roi_tracking = false;
+	// while tracking, look at the whole region every this many inferences
+	size_t roi_redetect = 30;
+	// noise reduction before inference
+	bs_denoise_t denoise = bs_denoise_t::Bilateral;
+	// model interpreters (each with the above threads): with more than one,
+	// asynchronous processing pipelines frames, preparing the next and
+	// finishing the previous frame while one is being inferred
+	size_t interpreters = 1;
+};
+
+// Low resolution mask: guided filter coefficients at model resolution
+// covering a region of the frame (background everywhere else). The mask
+// value is 255 * (A * luma + B), evaluated against the frame it is applied to.
+struct bs_lowres_mask_t {
+	// full frame size
+	cv::Size size;
+	// frame region covered by the coefficients
+	cv::Rect roi;
+	// coefficients (32FC1)
+	cv::Mat a;
+	cv::Mat b;
+};
+
+// Processing statistics of a mask generation context
+struct bs_maskgen_stats_t {
+	// frames processed (each frame of a batch counts)
+	size_t frames = 0;
+	// frames served from a previous mask by motion gating
+	size_t skipped = 0;
+	// time spent on noise reduction for the last inference (all frames of a
+	// batch), readable from the onprep callback
+	long denoise_ns = 0;
+	// time spent in each stage (preparation including noise reduction,
+	// inference, mask post-processing) by the last frame (batch) through it.
+	// Pipelined stages of consecutive frames overlap, so these do not add
+	// up to the interval between masks.
+	long prep_ns = 0;
+	long infer_ns = 0;
+	long post_ns = 0;
+};
+
+// Inference delegate status of a mask generation context
+struct bs_delegate_info_t {
+	// XNNPACK delegate applied to the graph
+	bool active = false;
+	// number of nodes in the original graph
+	size_t nodes = 0;
+	// number of those nodes now executed by the delegate
+	size_t delegated = 0;
+	// number of delegate partitions (kernels) replacing them
+	size_t partitions = 0;
+};
+
 // Return a new (opaque) mask generation context
+extern void *bs_maskgen_new(
+	// Required parameters
+	const std::string& modelname,
+	const bs_maskgen_opts_t& opts,
+	size_t width,
+	size_t height,
+	// Optional (nullable) callbacks with caller-provided context
+	// ..debug output
+	void (*ondebug)(void *ctx, const char *msg),
+	// ..after preparing video frame
+	void (*onprep)(void *ctx),
+	// ..after running inference
+	void (*oninfer)(void *ctx),
+	// ..after generating mask
+	void (*onmask)(void *ctx),
+	// ..the returned context
+	void *caller_ctx
+);
+
+// As above, with default options and the given number of threads
 extern void *bs_maskgen_new(
 	// Required parameters
 	const std::string& modelname,
@@ -32,12 +163,189 @@ extern void *bs_maskgen_new(
 	void *caller_ctx
 );
 
+// Report how much of the graph runs on the XNNPACK delegate
+extern bool bs_maskgen_delegate_info(void *context, bs_delegate_info_t &info);
+
+// Report processing statistics (eg: motion gating hit rate). Callable from
+// any thread, including the callbacks of pipelined workers: stats is a
+// consistent snapshot taken while no engine updates them.
+extern bool bs_maskgen_stats(void *context, bs_maskgen_stats_t &stats);
+
 // Delete the mask generation context
 extern void bs_maskgen_delete(void *context);
 
 // Process a video frame into a mask
 extern bool bs_maskgen_process(void *context, cv::Mat& frame, cv::Mat &mask);
 
+// Process several video frames (eg: from different cameras) with a single
+// inference call, the model input batch dimension follows frames.size().
+// Each frame position keeps its own ROI, temporal mask state and output
+// mask, so pass sources in a consistent order. Frame sizes may differ, the
+// first position is shared with bs_maskgen_process.
+extern bool bs_maskgen_process_batch(void *context, std::vector<cv::Mat> &frames, std::vector<cv::Mat> &masks);
+
+// As above, returning low resolution masks for bs_composite instead of
+// full-size masks, which are then never computed
+extern bool bs_maskgen_process_lowres(void *context, std::vector<cv::Mat> &frames, std::vector<bs_lowres_mask_t> &masks);
+
+// Limited range Y'CbCr camera frame, eg: a capture driver buffer
+struct bs_yuv_frame_t {
+	// packed YUYV (y only), or NV12: luma plane y and a half resolution
+	// plane uv of interleaved Cb Cr. Width and height must be even.
+	bool nv12 = false;
+	bs_yuv_matrix_t matrix = bs_yuv_matrix_t::BT601;
+	int width = 0;
+	int height = 0;
+	const uint8_t *y = nullptr;
+	size_t ystride = 0;
+	const uint8_t *uv = nullptr;
+	size_t uvstride = 0;
+};
+
+// As bs_maskgen_process, straight from a Y'CbCr frame: only the pixels
+// sampled for the model input are converted to RGB, mask edges follow the
+// frame luma. The frame stays with the caller, and shares the stream
+// position (ROI, temporal mask) with bs_maskgen_process.
+extern bool bs_maskgen_process_yuv(void *context, const bs_yuv_frame_t &frame, cv::Mat &mask);
+
+// As above, returning a low resolution mask
+extern bool bs_maskgen_process_yuv_lowres(void *context, const bs_yuv_frame_t &frame, bs_lowres_mask_t &mask);
+
+// Asynchronous mask generation: frames are queued for worker threads owned
+// by the context (one per interpreter), which process them in order and
+// hand back each mask tagged with the sequence number it was submitted with.
+struct bs_mask_result_t {
+	// caller-provided sequence number of the frame
+	uint64_t seq = 0;
+	// false if processing failed (masks are then empty)
+	bool ok = false;
+	// the submitted frame (same buffer, not a copy) and its mask (8UC1),
+	// or its low resolution mask
+	cv::Mat frame;
+	cv::Mat mask;
+	bs_lowres_mask_t lowres;
+};
+
+// Start the workers: at most depth frames may be pending (queued, being
+// processed, or processed and not yet polled), pipelining needs at least
+// one per interpreter. With lowres, results carry low resolution masks
+// instead of full-size ones. With ondone, results are passed to it on a
+// worker thread (along with the caller context given to bs_maskgen_new)
+// instead of being queued for bs_maskgen_poll.
+// Optional, the first submit starts workers with depth 2, full-size masks
+// and no callback. The other callbacks of the context are also called on
+// worker threads, concurrently when pipelining.
+extern bool bs_maskgen_async(void *context, size_t depth, bool lowres, void (*ondone)(void *ctx, bs_mask_result_t &result));
+
+// Queue frame for processing without waiting. The frame is referenced,
+// not copied, so its pixels must stay untouched until its result arrives.
+// Returns false (and does not take the frame) when depth frames are pending.
+extern bool bs_maskgen_submit(void *context, cv::Mat &frame, uint64_t seq);
+
+// Fetch the oldest finished result, optionally waiting for one if any frame
+// is still pending. Returns false if there is none.
+extern bool bs_maskgen_poll(void *context, bs_mask_result_t &result, bool wait = false);
+
+// Blend background over foreground (8UC3, same size) into out (which may be
+// fg), evaluating the low resolution mask on the fly row by row. Without a
+// mask for this frame size the output is all background.
+extern bool bs_composite(const bs_lowres_mask_t &mask, cv::Mat &bg, cv::Mat &fg, cv::Mat &out);
+
+// Blend background over foreground (8UC3, same size) into out (which may be
+// fg or bg) with a full size mask (8UC1, 255 => background), using the
+// widest SIMD instruction set the CPU offers.
+extern bool bs_alpha_blend(cv::Mat &mask, cv::Mat &bg, cv::Mat &fg, cv::Mat &out);
+
+// Convert a BGR frame (8UC3, even width) into packed YUYV 4:2:2 at out,
+// with rows stride bytes apart, eg: straight into a video device buffer.
+// Each chroma sample is taken from the mean of its pixel pair.
+extern bool bs_bgr_to_yuyv(cv::Mat &bgr, bs_yuv_matrix_t matrix, uint8_t *out, size_t stride);
+
+// As above, into NV12 4:2:0 (even width and height): a luma plane and a
+// plane of interleaved Cb Cr samples, each from the mean of a 2x2 block
+extern bool bs_bgr_to_nv12(cv::Mat &bgr, bs_yuv_matrix_t matrix, uint8_t *y, size_t ystride, uint8_t *uv, size_t uvstride);
+
+// Virtual camera frame produced by bs_compose
+struct bs_output_t {
+	// geometry, the composited frame is scaled (bilinear) when it differs
+	// (empty: frame size). The width must be even.
+	cv::Size size;
+	// mirror horizontally / vertically
+	bool flip_h = false;
+	bool flip_v = false;
+	// Y'CbCr formats need an even width, 4:2:0 an even height as well
+	bs_pixfmt_t format = bs_pixfmt_t::YUYV;
+	bs_yuv_matrix_t matrix = bs_yuv_matrix_t::BT601;
+};
+
+// Smallest stride (bytes per row of the first plane) of an output frame
+// width pixels wide, and the bytes of a whole frame with the given stride
+extern size_t bs_output_stride(bs_pixfmt_t format, size_t width);
+extern size_t bs_output_bytes(bs_pixfmt_t format, size_t height, size_t stride);
+
+// Worker pool: persistent threads splitting frames into row bands. Returns
+// a new (opaque) pool of the given number of threads, which callers of
+// bs_workers_run join while waiting, so a budget of n threads takes n - 1.
+// A pool may be shared by several streams.
+extern void *bs_workers_new(size_t threads);
+
+// Delete the pool (no runs may be in progress)
+extern void bs_workers_delete(void *workers);
+
+// Run task(i) for every i in [0, tasks) on the pool and the calling thread,
+// returning once all have finished. Idle threads claim tasks one at a time,
+// so prefer a few more tasks than threads. workers may be nullptr.
+extern void bs_workers_run(void *workers, size_t tasks, const std::function<void(size_t)> &task);
+
+// Output compositor: returns a new (opaque) context keeping sampling tables
+// between frames, running its stripes on workers (may be nullptr). Use one
+// per stream.
+extern void *bs_compose_new(void *workers);
+
+// Delete the compositor
+extern void bs_compose_delete(void *context);
+
+// Blend, flip, scale and convert to the output format in one pass over
+// horizontal stripes which stay in cache, writing straight into out (first
+// plane rows stride bytes apart). bg is blended over fg (8UC3, same size) with the full size mask
+// if given, else with the low resolution lmask if given (all background
+// while it does not fit the frame), fg is output as is with neither.
+extern bool bs_compose(void *context, const bs_output_t &output, const cv::Mat *mask, const bs_lowres_mask_t *lmask,
+	cv::Mat &bg, cv::Mat &fg, uint8_t *out, size_t stride);
+
+// Render a low resolution mask at full size against frame (8UC1 result)
+extern bool bs_lowres_render(const bs_lowres_mask_t &mask, cv::Mat &frame, cv::Mat &out);
+
+// Mask propagation: warp the mask of the last inferred (key) frame onto
+// later frames using low resolution dense optical flow, so inference can
+// run less often than the camera without masks lagging behind motion.
+// Returns a new (opaque) context for frames of the given geometry.
+extern void *bs_propagate_new(size_t width, size_t height);
+
+// Delete the propagation context
+extern void bs_propagate_delete(void *context);
+
+// Set the key frame and the mask generated from it
+extern bool bs_propagate_key(void *context, cv::Mat &frame, cv::Mat &mask);
+
+// Warp the key mask onto frame, writing a full size mask. Returns false
+// (and leaves mask alone) until a key frame is set.
+extern bool bs_propagate(void *context, cv::Mat &frame, cv::Mat &mask);
+
+// Buffer pool: reusable image buffers keyed by geometry and type. Buffers
+// are handed out as plain cv::Mats and are free again once the pool holds
+// the only reference, so steady state processing allocates nothing.
+// Returns a new (opaque) pool, used from one thread at a time (buffers may
+// be let go of on any thread).
+extern void *bs_pool_new(void);
+
+// Delete the pool, buffers still in use stay valid
+extern void bs_pool_delete(void *pool);
+
+// Point out at a free buffer of the given geometry and type, after letting
+// go of whatever out referenced. The contents are undefined.
+extern bool bs_pool_get(void *pool, cv::Size size, int type, cv::Mat &out);
+
 extern cv::Rect calcCropping(int inWidth, int inHeight, int targetWidth, int targetHight);
 
 #endif
@@ -0,0 +1,52 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <cmath>
+#include <algorithm>
+
+#include "motion.h"
+
+void motion_signature(const cv::Mat &frame, cv::Mat &sig) {
+	CV_Assert((frame.type() == CV_8UC3 || frame.type() == CV_8UC2 || frame.type() == CV_8UC1) && !frame.empty());
+	const int cn = frame.channels();
+	int gw = std::min(MOTION_GRID_W, frame.cols);
+	int gh = std::max(1, std::min(frame.rows, (int)lround((double)gw * frame.rows / frame.cols)));
+	// sample every step'th pixel in both directions, at least one per cell
+	int step = std::max(1, std::min(4, std::min(frame.cols / gw, frame.rows / gh)));
+	sig.create(gh, gw, CV_8UC1);
+
+	// cell of each sampled column
+	size_t ncols = (frame.cols + step - 1) / step;
+	cv::AutoBuffer<int> cell(ncols);
+	for (size_t i = 0; i < ncols; i++)
+		cell[i] = (int)i * step * gw / frame.cols;
+	cv::AutoBuffer<uint32_t, MOTION_GRID_W> sum(gw), cnt(gw);
+	for (int gy = 0; gy < gh; gy++) {
+		std::fill(sum.data(), sum.data() + gw, 0);
+		std::fill(cnt.data(), cnt.data() + gw, 0);
+		int y1 = (gy + 1) * frame.rows / gh;
+		for (int y = gy * frame.rows / gh; y < y1; y += step) {
+			const uint8_t *row = frame.ptr<uint8_t>(y);
+			for (size_t i = 0; i < ncols; i++) {
+				// luma approximation (B + 2G + R) / 4, or luma itself
+				const uint8_t *p = row + cn * i * step;
+				sum[cell[i]] += 3 == cn ? p[0] + 2 * p[1] + p[2] : 4 * p[0];
+				cnt[cell[i]] += 4;
+			}
+		}
+		uint8_t *out = sig.ptr<uint8_t>(gy);
+		for (int gx = 0; gx < gw; gx++)
+			out[gx] = cnt[gx] ? (uint8_t)(sum[gx] / cnt[gx]) : 0;
+	}
+}
+
+float motion_changed(const cv::Mat &a, const cv::Mat &b) {
+	CV_Assert(a.type() == CV_8UC1 && a.size() == b.size() && a.isContinuous() && b.isContinuous());
+	const uint8_t *pa = a.ptr<uint8_t>();
+	const uint8_t *pb = b.ptr<uint8_t>();
+	size_t n = a.total(), changed = 0;
+	for (size_t i = 0; i < n; i++)
+		changed += std::abs((int)pa[i] - (int)pb[i]) > MOTION_NOISE;
+	return n ? (float)changed / (float)n : 0.0f;
+}
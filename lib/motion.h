@@ -0,0 +1,28 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _MOTION_H
+#define _MOTION_H
+
+#include <opencv2/core/core.hpp>
+
+// Cheap scene change detection for inference gating. A frame is reduced
+// to a small grid of block-average luma values (its signature), which are
+// compared cell by cell against the signature of the last inferred frame.
+
+// signature grid width, the height follows the frame aspect
+#define MOTION_GRID_W 64
+// block averages differing by more than this count as changed (sensor noise)
+#define MOTION_NOISE 12
+
+// Compute the signature (8UC1) of an 8UC3 (BGR) frame, or of the luma of a
+// Y'CbCr frame given as its luma plane (8UC1) or packed YUYV (8UC2),
+// sampling a sparse subset of its pixels
+void motion_signature(const cv::Mat &frame, cv::Mat &sig);
+
+// Fraction [0,1] of cells that changed between two signatures of the same
+// frame geometry
+float motion_changed(const cv::Mat &a, const cv::Mat &b);
+
+#endif
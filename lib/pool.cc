@@ -0,0 +1,69 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <vector>
+#include <algorithm>
+
+#include "libbackscrub.h"
+
+// buffers kept at most, beyond that requests are served unpooled
+#define POOL_MAX 32
+// free buffers not handed out for this many requests are dropped (eg: after
+// a geometry change)
+#define POOL_IDLE 256
+
+struct pool_entry_t {
+	cv::Mat buf;
+	// request count when last handed out
+	size_t used;
+};
+
+struct pool_ctx_t {
+	std::vector<pool_entry_t> entries;
+	size_t clock = 0;
+};
+
+// Nobody but the pool references the buffer. Holders drop their references
+// on other threads (CV_XADD), so the count is read atomically, acquiring
+// whatever the last holder did with the buffer before it is rewritten.
+static bool is_free(const cv::Mat &buf) {
+	return buf.u && 1 == __atomic_load_n(&buf.u->refcount, __ATOMIC_ACQUIRE);
+}
+
+void *bs_pool_new(void) {
+	return new pool_ctx_t;
+}
+
+void bs_pool_delete(void *context) {
+	if (!context)
+		return;
+	// buffers still handed out live on with their holders
+	delete (pool_ctx_t *)context;
+}
+
+bool bs_pool_get(void *context, cv::Size size, int type, cv::Mat &out) {
+	if (!context || size.width <= 0 || size.height <= 0)
+		return false;
+	pool_ctx_t &ctx = *((pool_ctx_t *)context);
+	// give back whatever out held (may be a pool buffer itself)
+	out.release();
+	ctx.clock++;
+	auto hit = std::find_if(ctx.entries.begin(), ctx.entries.end(), [&](const pool_entry_t &e) {
+		return e.buf.size() == size && e.buf.type() == type && is_free(e.buf);
+	});
+	if (hit == ctx.entries.end()) {
+		ctx.entries.erase(std::remove_if(ctx.entries.begin(), ctx.entries.end(), [&](const pool_entry_t &e) {
+			return is_free(e.buf) && ctx.clock - e.used > POOL_IDLE;
+		}), ctx.entries.end());
+		if (ctx.entries.size() >= POOL_MAX) {
+			out.create(size, type);
+			return true;
+		}
+		ctx.entries.push_back({ cv::Mat(size, type), 0 });
+		hit = ctx.entries.end() - 1;
+	}
+	hit->used = ctx.clock;
+	out = hit->buf;
+	return true;
+}
@@ -0,0 +1,442 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <string.h>
+#include <algorithm>
+
+#include "simd.h"
+#include "postprocess.h"
+
+// class scores at or below this never win the argmax (historical sentinel)
+static const float argmax_floor = -10000.0f;
+
+// temporal update of a single mask byte
+static inline uint8_t temporal(bool person, uint8_t old) {
+	return (person ? 0 : 0xE0) | (old >> 3);
+}
+
+// background byte patterns for every combination of 8 person bits, so the
+// bitmask paths can update 8 mask bytes with a couple of integer ops
+struct bits_table_t {
+	uint64_t bg[256];
+	bits_table_t() {
+		for (int m = 0; m < 256; m++) {
+			uint8_t b[8];
+			for (int i = 0; i < 8; i++)
+				b[i] = (m & (1<<i)) ? 0 : 0xE0;
+			memcpy(&bg[m], b, sizeof(b));
+		}
+	}
+};
+static const bits_table_t bits_table;
+
+// temporal update of 8 mask bytes, bit i of person set => pixel i is person
+static inline void temporal8(uint8_t *mask, unsigned person) {
+	uint64_t old;
+	memcpy(&old, mask, sizeof(old));
+	old = ((old >> 3) & 0x1F1F1F1F1F1F1F1FULL) | bits_table.bg[person & 0xFF];
+	memcpy(mask, &old, sizeof(old));
+}
+
+// lanes [0,width) of a chunk starting at class c0 which lie before / after the person class
+static unsigned lanes_before(size_t c0, size_t width, size_t classes, size_t person) {
+	unsigned bits = 0;
+	for (size_t j = 0; j < width && c0+j < classes; j++)
+		if (c0+j < person)
+			bits |= 1u << j;
+	return bits;
+}
+static unsigned lanes_after(size_t c0, size_t width, size_t classes, size_t person) {
+	unsigned bits = 0;
+	for (size_t j = 0; j < width && c0+j < classes; j++)
+		if (c0+j > person)
+			bits |= 1u << j;
+	return bits;
+}
+
+// the widest class vector we handle with SIMD (DeepLab has 21)
+static const size_t max_chunks = 8;
+
+// Scalar reference implementations
+
+static void argmax_scalar(const float *s, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	for (size_t i = 0; i < n; i++, s += classes) {
+		float p = s[person];
+		bool win = p > argmax_floor;
+		// earlier classes win ties, later ones do not
+		for (size_t c = 0; win && c < person; c++)
+			win = s[c] < p;
+		for (size_t c = person+1; win && c < classes; c++)
+			win = s[c] <= p;
+		mask[i] = temporal(win, mask[i]);
+	}
+}
+
+static void softmax2_scalar(const float *l, size_t n, uint8_t *mask) {
+	for (size_t i = 0; i < n; i++)
+		mask[i] = temporal(l[2*i] < l[2*i+1], mask[i]);
+}
+
+static void threshold_scalar(const float *p, size_t n, float threshold, uint8_t *mask) {
+	for (size_t i = 0; i < n; i++)
+		mask[i] = temporal(p[i] > threshold, mask[i]);
+}
+
+#if defined(BS_SIMD_X86)
+
+BS_TARGET_AVX2 static void argmax_avx2(const float *s, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	size_t chunks = (classes + 7) / 8;
+	unsigned before[max_chunks], after[max_chunks];
+	__m256i load[max_chunks];
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	for (size_t k = 0; k < chunks; k++) {
+		before[k] = lanes_before(8*k, 8, classes, person);
+		after[k] = lanes_after(8*k, 8, classes, person);
+		load[k] = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)std::min<size_t>(8, classes-8*k)), lane);
+	}
+	for (size_t i = 0; i < n; i++, s += classes) {
+		float p = s[person];
+		__m256 vp = _mm256_set1_ps(p);
+		unsigned beats = 0;
+		for (size_t k = 0; k < chunks; k++) {
+			__m256 v = _mm256_maskload_ps(s + 8*k, load[k]);
+			beats |= (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(v, vp, _CMP_GE_OQ)) & before[k];
+			beats |= (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(v, vp, _CMP_GT_OQ)) & after[k];
+		}
+		mask[i] = temporal(!beats && p > argmax_floor, mask[i]);
+	}
+}
+
+BS_TARGET_AVX2 static void softmax2_avx2(const float *l, size_t n, uint8_t *mask) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 a = _mm256_loadu_ps(l + 2*i);
+		__m256 b = _mm256_loadu_ps(l + 2*i + 8);
+		__m256 bg = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 fg = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		unsigned m = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(bg, fg, _CMP_LT_OQ));
+		// in-lane shuffles leave the pixels in 0,1,4,5,2,3,6,7 order
+		m = (m & 0xC3) | ((m & 0x0C) << 2) | ((m & 0x30) >> 2);
+		temporal8(mask + i, m);
+	}
+	softmax2_scalar(l + 2*i, n - i, mask + i);
+}
+
+BS_TARGET_AVX2 static void threshold_avx2(const float *p, size_t n, float threshold, uint8_t *mask) {
+	const __m256 vt = _mm256_set1_ps(threshold);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_loadu_ps(p + i);
+		temporal8(mask + i, (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(v, vt, _CMP_GT_OQ)));
+	}
+	threshold_scalar(p + i, n - i, threshold, mask + i);
+}
+
+BS_TARGET_SSE41 static void argmax_sse41(const float *s, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	size_t chunks = classes / 4;
+	unsigned before[2*max_chunks], after[2*max_chunks];
+	for (size_t k = 0; k < chunks; k++) {
+		before[k] = lanes_before(4*k, 4, classes, person);
+		after[k] = lanes_after(4*k, 4, classes, person);
+	}
+	for (size_t i = 0; i < n; i++, s += classes) {
+		float p = s[person];
+		__m128 vp = _mm_set1_ps(p);
+		unsigned beats = 0;
+		for (size_t k = 0; k < chunks; k++) {
+			__m128 v = _mm_loadu_ps(s + 4*k);
+			beats |= (unsigned)_mm_movemask_ps(_mm_cmpge_ps(v, vp)) & before[k];
+			beats |= (unsigned)_mm_movemask_ps(_mm_cmpgt_ps(v, vp)) & after[k];
+		}
+		for (size_t c = 4*chunks; c < classes; c++)
+			if (c < person ? s[c] >= p : (c > person && s[c] > p))
+				beats = 1;
+		mask[i] = temporal(!beats && p > argmax_floor, mask[i]);
+	}
+}
+
+BS_TARGET_SSE41 static void softmax2_sse41(const float *l, size_t n, uint8_t *mask) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		unsigned m = 0;
+		for (int h = 0; h < 2; h++) {
+			__m128 a = _mm_loadu_ps(l + 2*i + 8*h);
+			__m128 b = _mm_loadu_ps(l + 2*i + 8*h + 4);
+			__m128 bg = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 fg = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			m |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(bg, fg)) << (4*h);
+		}
+		temporal8(mask + i, m);
+	}
+	softmax2_scalar(l + 2*i, n - i, mask + i);
+}
+
+BS_TARGET_SSE41 static void threshold_sse41(const float *p, size_t n, float threshold, uint8_t *mask) {
+	const __m128 vt = _mm_set1_ps(threshold);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		unsigned m = (unsigned)_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(p + i), vt));
+		m |= (unsigned)_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(p + i + 4), vt)) << 4;
+		temporal8(mask + i, m);
+	}
+	threshold_scalar(p + i, n - i, threshold, mask + i);
+}
+
+#endif // BS_SIMD_X86
+
+#if defined(BS_SIMD_NEON)
+
+// temporal update of 8 mask bytes from two all-ones/all-zeros person lane vectors
+static inline void temporal8_neon(uint8_t *mask, uint32x4_t lo, uint32x4_t hi) {
+	uint8x8_t person = vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+	uint8x8_t old = vld1_u8(mask);
+	vst1_u8(mask, vorr_u8(vbic_u8(vdup_n_u8(0xE0), person), vshr_n_u8(old, 3)));
+}
+
+// expand a lane bitmask into an all-ones/all-zeros lane vector
+static inline uint32x4_t lanes_neon(unsigned bits) {
+	uint32_t l[4];
+	for (int j = 0; j < 4; j++)
+		l[j] = (bits & (1u << j)) ? 0xFFFFFFFFu : 0;
+	return vld1q_u32(l);
+}
+
+static void argmax_neon(const float *s, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	size_t chunks = classes / 4;
+	uint32x4_t before[2*max_chunks], after[2*max_chunks];
+	for (size_t k = 0; k < chunks; k++) {
+		before[k] = lanes_neon(lanes_before(4*k, 4, classes, person));
+		after[k] = lanes_neon(lanes_after(4*k, 4, classes, person));
+	}
+	for (size_t i = 0; i < n; i++, s += classes) {
+		float p = s[person];
+		float32x4_t vp = vdupq_n_f32(p);
+		uint32x4_t acc = vdupq_n_u32(0);
+		for (size_t k = 0; k < chunks; k++) {
+			float32x4_t v = vld1q_f32(s + 4*k);
+			acc = vorrq_u32(acc, vandq_u32(vcgeq_f32(v, vp), before[k]));
+			acc = vorrq_u32(acc, vandq_u32(vcgtq_f32(v, vp), after[k]));
+		}
+		uint32x2_t r = vorr_u32(vget_low_u32(acc), vget_high_u32(acc));
+		bool beats = (vget_lane_u32(r, 0) | vget_lane_u32(r, 1)) != 0;
+		for (size_t c = 4*chunks; c < classes; c++)
+			if (c < person ? s[c] >= p : (c > person && s[c] > p))
+				beats = true;
+		mask[i] = temporal(!beats && p > argmax_floor, mask[i]);
+	}
+}
+
+static void softmax2_neon(const float *l, size_t n, uint8_t *mask) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		float32x4x2_t a = vld2q_f32(l + 2*i);
+		float32x4x2_t b = vld2q_f32(l + 2*i + 8);
+		temporal8_neon(mask + i, vcltq_f32(a.val[0], a.val[1]), vcltq_f32(b.val[0], b.val[1]));
+	}
+	softmax2_scalar(l + 2*i, n - i, mask + i);
+}
+
+static void threshold_neon(const float *p, size_t n, float threshold, uint8_t *mask) {
+	const float32x4_t vt = vdupq_n_f32(threshold);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		temporal8_neon(mask + i, vcgtq_f32(vld1q_f32(p + i), vt), vcgtq_f32(vld1q_f32(p + i + 4), vt));
+	threshold_scalar(p + i, n - i, threshold, mask + i);
+}
+
+#endif // BS_SIMD_NEON
+
+// Dispatchers
+
+void post_argmax(const float *scores, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	if (classes <= 8*max_chunks && person < classes) {
+		switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+			case simd_level_t::AVX2:
+				argmax_avx2(scores, n, classes, person, mask);
+				return;
+			case simd_level_t::SSE41:
+				argmax_sse41(scores, n, classes, person, mask);
+				return;
+#endif
+#if defined(BS_SIMD_NEON)
+			case simd_level_t::NEON:
+				argmax_neon(scores, n, classes, person, mask);
+				return;
+#endif
+			default:
+				break;
+		}
+	}
+	argmax_scalar(scores, n, classes, person, mask);
+}
+
+void post_softmax2(const float *logits, size_t n, uint8_t *mask) {
+	switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+		case simd_level_t::AVX2:
+			softmax2_avx2(logits, n, mask);
+			return;
+		case simd_level_t::SSE41:
+			softmax2_sse41(logits, n, mask);
+			return;
+#endif
+#if defined(BS_SIMD_NEON)
+		case simd_level_t::NEON:
+			softmax2_neon(logits, n, mask);
+			return;
+#endif
+		default:
+			softmax2_scalar(logits, n, mask);
+			return;
+	}
+}
+
+void post_threshold(const float *prob, size_t n, float threshold, uint8_t *mask) {
+	switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+		case simd_level_t::AVX2:
+			threshold_avx2(prob, n, threshold, mask);
+			return;
+		case simd_level_t::SSE41:
+			threshold_sse41(prob, n, threshold, mask);
+			return;
+#endif
+#if defined(BS_SIMD_NEON)
+		case simd_level_t::NEON:
+			threshold_neon(prob, n, threshold, mask);
+			return;
+#endif
+		default:
+			threshold_scalar(prob, n, threshold, mask);
+			return;
+	}
+}
+
+// Quantized kernels
+
+template<typename T> static void argmax_q8(const T *s, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	for (size_t i = 0; i < n; i++, s += classes) {
+		T p = s[person];
+		bool win = true;
+		for (size_t c = 0; win && c < person; c++)
+			win = s[c] < p;
+		for (size_t c = person+1; win && c < classes; c++)
+			win = s[c] <= p;
+		mask[i] = temporal(win, mask[i]);
+	}
+}
+
+template<typename T> static void softmax2_q8(const T *l, size_t n, uint8_t *mask) {
+	for (size_t i = 0; i < n; i++)
+		mask[i] = temporal(l[2*i] < l[2*i+1], mask[i]);
+}
+
+// threshold of signed bytes (unsigned input is flipped into the signed range
+// by xor 0x80), person where q > t
+static void threshold_s8_scalar(const int8_t *q, size_t n, uint8_t flip, int8_t t, uint8_t *mask) {
+	for (size_t i = 0; i < n; i++)
+		mask[i] = temporal((int8_t)((uint8_t)q[i] ^ flip) > t, mask[i]);
+}
+
+#if defined(BS_SIMD_X86)
+
+BS_TARGET_AVX2 static void threshold_s8_avx2(const int8_t *q, size_t n, uint8_t flip, int8_t t, uint8_t *mask) {
+	const __m256i vf = _mm256_set1_epi8((char)flip), vt = _mm256_set1_epi8(t);
+	const __m256i bg = _mm256_set1_epi8((char)0xE0), lo5 = _mm256_set1_epi8(0x1F);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(q + i)), vf);
+		__m256i person = _mm256_cmpgt_epi8(v, vt);
+		__m256i old = _mm256_loadu_si256((const __m256i *)(mask + i));
+		old = _mm256_and_si256(_mm256_srli_epi16(old, 3), lo5);
+		_mm256_storeu_si256((__m256i *)(mask + i), _mm256_or_si256(_mm256_andnot_si256(person, bg), old));
+	}
+	threshold_s8_scalar(q + i, n - i, flip, t, mask + i);
+}
+
+BS_TARGET_SSE41 static void threshold_s8_sse41(const int8_t *q, size_t n, uint8_t flip, int8_t t, uint8_t *mask) {
+	const __m128i vf = _mm_set1_epi8((char)flip), vt = _mm_set1_epi8(t);
+	const __m128i bg = _mm_set1_epi8((char)0xE0), lo5 = _mm_set1_epi8(0x1F);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(q + i)), vf);
+		__m128i person = _mm_cmpgt_epi8(v, vt);
+		__m128i old = _mm_loadu_si128((const __m128i *)(mask + i));
+		old = _mm_and_si128(_mm_srli_epi16(old, 3), lo5);
+		_mm_storeu_si128((__m128i *)(mask + i), _mm_or_si128(_mm_andnot_si128(person, bg), old));
+	}
+	threshold_s8_scalar(q + i, n - i, flip, t, mask + i);
+}
+
+#endif // BS_SIMD_X86
+
+#if defined(BS_SIMD_NEON)
+
+static void threshold_s8_neon(const int8_t *q, size_t n, uint8_t flip, int8_t t, uint8_t *mask) {
+	const uint8x16_t vf = vdupq_n_u8(flip), bg = vdupq_n_u8(0xE0);
+	const int8x16_t vt = vdupq_n_s8(t);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		int8x16_t v = vreinterpretq_s8_u8(veorq_u8(vld1q_u8((const uint8_t *)(q + i)), vf));
+		uint8x16_t person = vcgtq_s8(v, vt);
+		uint8x16_t old = vld1q_u8(mask + i);
+		vst1q_u8(mask + i, vorrq_u8(vbicq_u8(bg, person), vshrq_n_u8(old, 3)));
+	}
+	threshold_s8_scalar(q + i, n - i, flip, t, mask + i);
+}
+
+#endif // BS_SIMD_NEON
+
+void post_argmax_q8(const void *scores, const tensor_fmt_t &fmt, size_t n, size_t classes, size_t person, uint8_t *mask) {
+	if (elem_t::I8 == fmt.type)
+		argmax_q8((const int8_t *)scores, n, classes, person, mask);
+	else
+		argmax_q8((const uint8_t *)scores, n, classes, person, mask);
+}
+
+void post_softmax2_q8(const void *logits, const tensor_fmt_t &fmt, size_t n, uint8_t *mask) {
+	if (elem_t::I8 == fmt.type)
+		softmax2_q8((const int8_t *)logits, n, mask);
+	else
+		softmax2_q8((const uint8_t *)logits, n, mask);
+}
+
+void post_threshold_q8(const void *prob, const tensor_fmt_t &fmt, size_t n, float threshold, uint8_t *mask) {
+	// real > threshold <=> q > threshold/scale + zero_point, in the signed domain
+	bool is_signed = elem_t::I8 == fmt.type;
+	uint8_t flip = is_signed ? 0 : 0x80;
+	int t = (int)floorf(threshold / fmt.scale) + fmt.zero_point - (is_signed ? 0 : 128);
+	if (t < -128 || t > 127) {
+		// everything (or nothing) is above the threshold
+		bool person = t < -128;
+		for (size_t i = 0; i < n; i++)
+			mask[i] = temporal(person, mask[i]);
+		return;
+	}
+	const int8_t *q = (const int8_t *)prob;
+	switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+		case simd_level_t::AVX2:
+			threshold_s8_avx2(q, n, flip, (int8_t)t, mask);
+			return;
+		case simd_level_t::SSE41:
+			threshold_s8_sse41(q, n, flip, (int8_t)t, mask);
+			return;
+#endif
+#if defined(BS_SIMD_NEON)
+		case simd_level_t::NEON:
+			threshold_s8_neon(q, n, flip, (int8_t)t, mask);
+			return;
+#endif
+		default:
+			threshold_s8_scalar(q, n, flip, (int8_t)t, mask);
+			return;
+	}
+}
+
+void post_widen_f16(const uint16_t *in, size_t n, float *out) {
+	for (size_t i = 0; i < n; i++)
+		out[i] = half_to_float(in[i]);
+}
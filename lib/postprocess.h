@@ -0,0 +1,38 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _POSTPROCESS_H
+#define _POSTPROCESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tensorfmt.h"
+
+// Per-model mask post-processing kernels. Each one decides person (0) or
+// background (255) for n output pixels and folds the result straight into
+// the small temporal mask: mask[i] = (val & 0xE0) | (mask[i] >> 3).
+
+// DeepLab: n pixels of interleaved class scores, person where class
+// 'person' wins the argmax (first maximum wins on ties, as before)
+void post_argmax(const float *scores, size_t n, size_t classes, size_t person, uint8_t *mask);
+
+// Google Meet: n pixels of interleaved (background, person) logits. The
+// softmax is monotonic, so person wins exactly when its logit is larger.
+void post_softmax2(const float *logits, size_t n, uint8_t *mask);
+
+// BodyPix/MLKit selfie: n person probabilities, person where p > threshold
+void post_threshold(const float *prob, size_t n, float threshold, uint8_t *mask);
+
+// Quantized (U8/I8) variants reading the raw tensor. Comparisons between
+// values of one tensor need no dequantization, the threshold is mapped
+// into the quantized domain once per call.
+void post_argmax_q8(const void *scores, const tensor_fmt_t &fmt, size_t n, size_t classes, size_t person, uint8_t *mask);
+void post_softmax2_q8(const void *logits, const tensor_fmt_t &fmt, size_t n, uint8_t *mask);
+void post_threshold_q8(const void *prob, const tensor_fmt_t &fmt, size_t n, float threshold, uint8_t *mask);
+
+// Widen n half precision values into floats (for F16 output tensors)
+void post_widen_f16(const uint16_t *in, size_t n, float *out);
+
+#endif
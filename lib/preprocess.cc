@@ -0,0 +1,146 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <cmath>
+#include <algorithm>
+#include <string.h>
+
+#include "preprocess.h"
+
+// one axis of the bilinear tables, cv::resize(INTER_LINEAR) compatible
+static void map_axis(int slen, int dlen, std::vector<int> &i0, std::vector<int> &i1, std::vector<float> &w) {
+	i0.resize(dlen);
+	i1.resize(dlen);
+	w.resize(dlen);
+	float scale = (float)slen / (float)dlen;
+	for (int d = 0; d < dlen; d++) {
+		float s = ((float)d + 0.5f) * scale - 0.5f;
+		int s0 = (int)floorf(s);
+		float f = s - (float)s0;
+		if (s0 < 0) {
+			s0 = 0;
+			f = 0;
+		}
+		if (s0 >= slen-1) {
+			s0 = slen-1;
+			f = 0;
+		}
+		i0[d] = s0;
+		i1[d] = std::min(s0+1, slen-1);
+		w[d] = f;
+	}
+}
+
+void prep_map_init(prep_map_t &map, cv::Size ssize, cv::Size dsize) {
+	map.ssize = ssize;
+	map.dsize = dsize;
+	map_axis(ssize.width, dsize.width, map.x0, map.x1, map.xw);
+	map_axis(ssize.height, dsize.height, map.y0, map.y1, map.yw);
+}
+
+void prep_bgr_to_rgbf(const prep_map_t &map, const cv::Mat &roi, cv::Mat &dst, float scaling, float offset) {
+	CV_Assert(roi.type() == CV_8UC3 && roi.size() == map.ssize);
+	CV_Assert(dst.type() == CV_32FC3 && dst.size() == map.dsize);
+	const int *x0 = map.x0.data();
+	const int *x1 = map.x1.data();
+	const float *xw = map.xw.data();
+	for (int dy = 0; dy < map.dsize.height; dy++) {
+		const uint8_t *r0 = roi.ptr<uint8_t>(map.y0[dy]);
+		const uint8_t *r1 = roi.ptr<uint8_t>(map.y1[dy]);
+		const float wy = map.yw[dy];
+		float *out = dst.ptr<float>(dy);
+		for (int dx = 0; dx < map.dsize.width; dx++) {
+			const uint8_t *p00 = r0 + 3*x0[dx], *p01 = r0 + 3*x1[dx];
+			const uint8_t *p10 = r1 + 3*x0[dx], *p11 = r1 + 3*x1[dx];
+			const float wx = xw[dx];
+			// interpolate each channel, writing in swapped (RGB) order
+			for (int c = 0; c < 3; c++) {
+				float t = (float)p00[c] + wx * (float)(p01[c] - p00[c]);
+				float b = (float)p10[c] + wx * (float)(p11[c] - p10[c]);
+				out[2-c] = (t + wy * (b - t)) * scaling + offset;
+			}
+			out += 3;
+		}
+	}
+}
+
+void prep_yuv_to_rgbf(const prep_map_t &map, const prep_yuv_t &src, cv::Point origin, cv::Mat &dst, float scaling, float offset) {
+	CV_Assert(src.y && (!src.nv12 || src.uv));
+	CV_Assert(dst.type() == CV_32FC3 && dst.size() == map.dsize);
+	// limited range (16-235, 16-240) to RGB, normalization folded in
+	const float kg = 1.0f - src.kr - src.kb;
+	const float ky = 255.0f / 219.0f * scaling, kc = 255.0f / 224.0f * scaling;
+	const float krv = 2.0f * (1.0f - src.kr) * kc;
+	const float kbu = 2.0f * (1.0f - src.kb) * kc;
+	const float kgu = -2.0f * (1.0f - src.kb) * src.kb / kg * kc;
+	const float kgv = -2.0f * (1.0f - src.kr) * src.kr / kg * kc;
+	const float lo = offset, hi = 255.0f * scaling + offset;
+	// absolute source columns and their luma / chroma byte offsets
+	const int n = map.dsize.width;
+	cv::AutoBuffer<int> ly0(n), ly1(n), lc0(n), lc1(n);
+	for (int dx = 0; dx < n; dx++) {
+		const int x0 = origin.x + map.x0[dx], x1 = origin.x + map.x1[dx];
+		ly0[dx] = src.nv12 ? x0 : 2*x0;
+		ly1[dx] = src.nv12 ? x1 : 2*x1;
+		// Cb of the pixel pair (Cr follows at +1 / +2)
+		lc0[dx] = src.nv12 ? x0 & ~1 : 4*(x0 >> 1) + 1;
+		lc1[dx] = src.nv12 ? x1 & ~1 : 4*(x1 >> 1) + 1;
+	}
+	const int cr = src.nv12 ? 1 : 2;
+	for (int dy = 0; dy < map.dsize.height; dy++) {
+		const int y0 = origin.y + map.y0[dy], y1 = origin.y + map.y1[dy];
+		const uint8_t *r0 = src.y + y0 * src.ystride, *r1 = src.y + y1 * src.ystride;
+		const uint8_t *c0 = src.nv12 ? src.uv + (y0 >> 1) * src.uvstride : r0;
+		const uint8_t *c1 = src.nv12 ? src.uv + (y1 >> 1) * src.uvstride : r1;
+		const float wy = map.yw[dy];
+		float *out = dst.ptr<float>(dy);
+		for (int dx = 0; dx < n; dx++, out += 3) {
+			const float wx = map.xw[dx];
+			auto lerp = [wx, wy](int p00, int p01, int p10, int p11) {
+				float t = (float)p00 + wx * (float)(p01 - p00);
+				float b = (float)p10 + wx * (float)(p11 - p10);
+				return t + wy * (b - t);
+			};
+			const float l = lerp(r0[ly0[dx]], r0[ly1[dx]], r1[ly0[dx]], r1[ly1[dx]]) - 16.0f;
+			const float u = lerp(c0[lc0[dx]], c0[lc1[dx]], c1[lc0[dx]], c1[lc1[dx]]) - 128.0f;
+			const float v = lerp(c0[lc0[dx]+cr], c0[lc1[dx]+cr], c1[lc0[dx]+cr], c1[lc1[dx]+cr]) - 128.0f;
+			const float yl = ky * l + offset;
+			out[0] = std::min(hi, std::max(lo, yl + krv * v));
+			out[1] = std::min(hi, std::max(lo, yl + kgu * u + kgv * v));
+			out[2] = std::min(hi, std::max(lo, yl + kbu * u));
+		}
+	}
+}
+
+void prep_store(const cv::Mat &src, cv::Mat &dst, const tensor_fmt_t &fmt) {
+	CV_Assert(src.type() == CV_32FC3 && src.size() == dst.size() && dst.channels() == 3);
+	const int n = src.cols * 3;
+	for (int y = 0; y < src.rows; y++) {
+		const float *in = src.ptr<float>(y);
+		switch (fmt.type) {
+			case elem_t::U8: {
+				uint8_t *out = dst.ptr<uint8_t>(y);
+				for (int i = 0; i < n; i++)
+					out[i] = (uint8_t)quantize(in[i], fmt, 0, 255);
+				break;
+			}
+			case elem_t::I8: {
+				int8_t *out = dst.ptr<int8_t>(y);
+				for (int i = 0; i < n; i++)
+					out[i] = (int8_t)quantize(in[i], fmt, -128, 127);
+				break;
+			}
+			case elem_t::F16: {
+				uint16_t *out = dst.ptr<uint16_t>(y);
+				for (int i = 0; i < n; i++)
+					out[i] = float_to_half(in[i]);
+				break;
+			}
+			case elem_t::F32:
+			default:
+				memcpy(dst.ptr<float>(y), in, n * sizeof(float));
+				break;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _PREPROCESS_H
+#define _PREPROCESS_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#include "tensorfmt.h"
+
+// Precomputed bilinear sampling tables, mapping a source region (in pixels)
+// onto a destination region of the model input. Tables follow the same
+// pixel-centre convention as cv::resize(INTER_LINEAR).
+struct prep_map_t {
+	cv::Size ssize;
+	cv::Size dsize;
+	// per destination column: left/right source pixel index & right weight
+	std::vector<int> x0, x1;
+	std::vector<float> xw;
+	// per destination row: top/bottom source row index & bottom weight
+	std::vector<int> y0, y1;
+	std::vector<float> yw;
+};
+
+// Build sampling tables for a source of size ssize scaled into dsize
+void prep_map_init(prep_map_t &map, cv::Size ssize, cv::Size dsize);
+
+// Fused crop + resize + BGR->RGB + normalize: samples the (8UC3, BGR) roi
+// once and writes normalized RGB floats (32FC3) into dst, which may be a
+// view of the interpreter input tensor. roi must match map.ssize, dst map.dsize.
+void prep_bgr_to_rgbf(const prep_map_t &map, const cv::Mat &roi, cv::Mat &dst, float scaling, float offset);
+
+// Limited range Y'CbCr camera frame: packed YUYV (y only), or NV12 with a
+// luma plane y and a half resolution plane uv of interleaved Cb Cr. kr and
+// kb are the luma weights of the colour matrix (BT.601: .299, .114).
+struct prep_yuv_t {
+	bool nv12 = false;
+	const uint8_t *y = nullptr;
+	size_t ystride = 0;
+	const uint8_t *uv = nullptr;
+	size_t uvstride = 0;
+	float kr = 0.299f;
+	float kb = 0.114f;
+};
+
+// As prep_bgr_to_rgbf, sampling the frame region at origin of map.ssize
+// straight from Y'CbCr: luma and chroma are interpolated, and only the
+// resulting model input pixels are converted to RGB.
+void prep_yuv_to_rgbf(const prep_map_t &map, const prep_yuv_t &src, cv::Point origin, cv::Mat &dst, float scaling, float offset);
+
+// Store normalized floats (32FC3) into a model input tensor of another
+// element format: dst is 8UC3 (U8), 8SC3 (I8) or 16UC3 holding raw halfs
+// (F16). 8-bit formats are quantized with the tensor scale/zero point.
+void prep_store(const cv::Mat &src, cv::Mat &dst, const tensor_fmt_t &fmt);
+
+#endif
@@ -0,0 +1,81 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <algorithm>
+
+#include <opencv2/video/tracking.hpp>
+
+#include "libbackscrub.h"
+
+// flow is computed at about model resolution, this wide
+#define PROPAGATE_WIDTH 256
+
+struct propagate_ctx_t {
+	// flow resolution and its identity map
+	cv::Size lowres;
+	cv::Mat grid;
+	// low resolution grey frame and mask of the last key (inferred) frame
+	cv::Mat key_grey;
+	cv::Mat key_mask;
+	// scratch buffers
+	cv::Mat small;
+	cv::Mat grey;
+	cv::Mat flow;
+	cv::Mat map;
+	cv::Mat warped;
+};
+
+// Low resolution greyscale copy of a frame for flow estimation
+static void to_grey(propagate_ctx_t &ctx, const cv::Mat &frame, cv::Mat &grey) {
+	cv::resize(frame, ctx.small, ctx.lowres, 0, 0, cv::INTER_AREA);
+	cv::cvtColor(ctx.small, grey, cv::COLOR_BGR2GRAY);
+}
+
+void *bs_propagate_new(size_t width, size_t height) {
+	if (!width || !height)
+		return nullptr;
+	propagate_ctx_t *pctx = new propagate_ctx_t;
+	propagate_ctx_t &ctx = *pctx;
+	int w = std::min((int)width, PROPAGATE_WIDTH);
+	int h = std::max(1, (int)(height * w / width));
+	ctx.lowres = cv::Size(w, h);
+	ctx.grid = cv::Mat(ctx.lowres, CV_32FC2);
+	for (int y = 0; y < h; y++) {
+		cv::Point2f *row = ctx.grid.ptr<cv::Point2f>(y);
+		for (int x = 0; x < w; x++)
+			row[x] = cv::Point2f((float)x, (float)y);
+	}
+	return pctx;
+}
+
+void bs_propagate_delete(void *context) {
+	if (!context)
+		return;
+	delete (propagate_ctx_t *)context;
+}
+
+bool bs_propagate_key(void *context, cv::Mat &frame, cv::Mat &mask) {
+	if (!context || frame.empty() || mask.empty())
+		return false;
+	propagate_ctx_t &ctx = *((propagate_ctx_t *)context);
+	to_grey(ctx, frame, ctx.key_grey);
+	cv::resize(mask, ctx.key_mask, ctx.lowres, 0, 0, cv::INTER_AREA);
+	return true;
+}
+
+bool bs_propagate(void *context, cv::Mat &frame, cv::Mat &mask) {
+	if (!context || frame.empty())
+		return false;
+	propagate_ctx_t &ctx = *((propagate_ctx_t *)context);
+	if (ctx.key_mask.empty())
+		return false;
+	// backward flow: where each pixel of this frame was in the key frame
+	to_grey(ctx, frame, ctx.grey);
+	cv::calcOpticalFlowFarneback(ctx.grey, ctx.key_grey, ctx.flow, 0.5, 3, 15, 3, 5, 1.2, 0);
+	cv::add(ctx.grid, ctx.flow, ctx.map);
+	// pull the key mask along the flow, then scale up to the frame
+	cv::remap(ctx.key_mask, ctx.warped, ctx.map, cv::Mat(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+	cv::resize(ctx.warped, mask, frame.size(), 0, 0, cv::INTER_LINEAR);
+	return true;
+}
@@ -0,0 +1,87 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+
+#include "roi.h"
+
+cv::Rect roi_person_bbox(const cv::Mat &mask, const cv::Rect &roidim) {
+	CV_Assert(mask.type() == CV_8UC1);
+	int x0 = mask.cols, x1 = -1, y0 = mask.rows, y1 = -1;
+	for (int y = 0; y < mask.rows; y++) {
+		const uint8_t *row = mask.ptr<uint8_t>(y);
+		int first = -1, last = -1;
+		for (int x = 0; x < mask.cols; x++) {
+			if (row[x] < 128) {
+				if (first < 0)
+					first = x;
+				last = x;
+			}
+		}
+		if (first < 0)
+			continue;
+		x0 = std::min(x0, first);
+		x1 = std::max(x1, last);
+		y0 = std::min(y0, y);
+		y1 = y;
+	}
+	if (x1 < 0)
+		return cv::Rect();
+	// mask cells -> frame pixels (cell edges, so the box covers whole cells)
+	float sx = (float)roidim.width / mask.cols;
+	float sy = (float)roidim.height / mask.rows;
+	int fx0 = roidim.x + (int)floorf(x0 * sx);
+	int fy0 = roidim.y + (int)floorf(y0 * sy);
+	int fx1 = roidim.x + (int)ceilf((x1 + 1) * sx);
+	int fy1 = roidim.y + (int)ceilf((y1 + 1) * sy);
+	return cv::Rect(fx0, fy0, fx1 - fx0, fy1 - fy0);
+}
+
+cv::Rect roi_around(const cv::Rect &bbox, float ratio, cv::Size min_size, cv::Size frame) {
+	float w = bbox.width * (1 + 2 * ROI_PADDING);
+	float h = bbox.height * (1 + 2 * ROI_PADDING);
+	w = std::max(w, (float)min_size.width);
+	h = std::max(h, (float)min_size.height);
+	// grow the short side to the model aspect
+	if (h / w < ratio)
+		h = w * ratio;
+	else
+		w = h / ratio;
+	int rw = (int)lroundf(w), rh = (int)lroundf(h);
+	if (rw > frame.width || rh > frame.height)
+		return cv::Rect();
+	// centre on the person, then push back inside the frame
+	int rx = bbox.x + bbox.width / 2 - rw / 2;
+	int ry = bbox.y + bbox.height / 2 - rh / 2;
+	rx = std::max(0, std::min(rx, frame.width - rw));
+	ry = std::max(0, std::min(ry, frame.height - rh));
+	return cv::Rect(rx, ry, rw, rh);
+}
+
+void roi_remap_mask(const cv::Mat &mask, const cv::Rect &from, const cv::Rect &to, cv::Mat &out, std::vector<int> &cols) {
+	CV_Assert(mask.type() == CV_8UC1 && out.data != mask.data);
+	out.create(mask.size(), CV_8UC1);
+	// source cell of each destination column (-1 if outside the old region)
+	cols.resize(mask.cols);
+	for (int x = 0; x < mask.cols; x++) {
+		float fx = to.x + (x + 0.5f) * to.width / mask.cols;
+		int ox = (int)floorf((fx - from.x) * mask.cols / from.width);
+		cols[x] = ox >= 0 && ox < mask.cols ? ox : -1;
+	}
+	for (int y = 0; y < mask.rows; y++) {
+		float fy = to.y + (y + 0.5f) * to.height / mask.rows;
+		int oy = (int)floorf((fy - from.y) * mask.rows / from.height);
+		uint8_t *dst = out.ptr<uint8_t>(y);
+		if (oy < 0 || oy >= mask.rows) {
+			memset(dst, 255, mask.cols);
+			continue;
+		}
+		const uint8_t *src = mask.ptr<uint8_t>(oy);
+		for (int x = 0; x < mask.cols; x++)
+			dst[x] = cols[x] >= 0 ? src[cols[x]] : 255;
+	}
+}
@@ -0,0 +1,30 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _ROI_H
+#define _ROI_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+// Person ROI tracking helpers. A model-size mask always covers a region
+// (roidim) of the frame, stretched over the whole mask as in upscaling.
+
+// padding added around the person on each side, as a fraction of its size
+#define ROI_PADDING 0.2f
+
+// Bounding box, in frame coordinates, of the person (values < 128) in a
+// model-size mask covering roidim. Empty if there is no person.
+cv::Rect roi_person_bbox(const cv::Mat &mask, const cv::Rect &roidim);
+
+// Padded region around bbox with the model aspect ratio (height/width), at
+// least min_size and moved inside the frame. Empty if it does not fit.
+cv::Rect roi_around(const cv::Rect &bbox, float ratio, cv::Size min_size, cv::Size frame);
+
+// Resample a model-size mask covering region from into out covering region
+// to instead, parts not covered before become background (255). out and the
+// cols table are caller scratch, reused while the mask size is unchanged.
+void roi_remap_mask(const cv::Mat &mask, const cv::Rect &from, const cv::Rect &to, cv::Mat &out, std::vector<int> &cols);
+
+#endif
@@ -0,0 +1,54 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <initializer_list>
+
+#include "simd.h"
+
+static simd_level_t detect(void) {
+#if defined(BS_SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return simd_level_t::AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return simd_level_t::SSE41;
+#elif defined(BS_SIMD_NEON)
+	return simd_level_t::NEON;
+#endif
+	return simd_level_t::Scalar;
+}
+
+simd_level_t simd_level() {
+	static const simd_level_t level = []() {
+		simd_level_t best = detect();
+		const char *env = getenv("BACKSCRUB_SIMD");
+		if (!env)
+			return best;
+		for (simd_level_t l : { simd_level_t::Scalar, simd_level_t::SSE41, simd_level_t::AVX2, simd_level_t::NEON }) {
+			if (strcmp(env, simd_name(l)) != 0)
+				continue;
+			// only allow stepping down to something this CPU can run
+			if (l == best || l == simd_level_t::Scalar || (l == simd_level_t::SSE41 && best == simd_level_t::AVX2))
+				return l;
+		}
+		return best;
+	}();
+	return level;
+}
+
+const char *simd_name(simd_level_t level) {
+	switch (level) {
+		case simd_level_t::SSE41:
+			return "sse41";
+		case simd_level_t::AVX2:
+			return "avx2";
+		case simd_level_t::NEON:
+			return "neon";
+		case simd_level_t::Scalar:
+		default:
+			return "scalar";
+	}
+}
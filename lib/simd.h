@@ -0,0 +1,40 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _SIMD_H
+#define _SIMD_H
+
+// Instruction set helpers shared by the vectorized kernels. On x86 we build
+// each variant with a function-level target attribute and pick one at run
+// time, so a generic (eg: distro) build still gets the fast paths. NEON is
+// part of the ARM baseline we build for, so it is selected at compile time.
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BS_SIMD_X86 1
+#include <immintrin.h>
+#define BS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define BS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BS_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+enum class simd_level_t {
+	Scalar,
+	SSE41,
+	AVX2,
+	NEON,
+};
+
+// Best instruction set available on this CPU, detected once. Can be lowered
+// (never raised) by setting BACKSCRUB_SIMD=scalar|sse41|avx2|neon, which is
+// handy when chasing a suspected kernel bug.
+simd_level_t simd_level();
+
+// Printable name of a level
+const char *simd_name(simd_level_t level);
+
+#endif
@@ -0,0 +1,93 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _TENSORFMT_H
+#define _TENSORFMT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Element format of a model input/output tensor
+enum class elem_t {
+	F32,
+	F16,
+	U8,
+	I8,
+};
+
+// Tensor element format with affine quantization (8-bit types only):
+// real = scale * (q - zero_point)
+struct tensor_fmt_t {
+	elem_t type;
+	float scale;
+	int zero_point;
+};
+
+// IEEE half <-> single precision conversions (round to nearest even)
+static inline float half_to_float(uint16_t h) {
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1F;
+	uint32_t man = h & 0x3FF;
+	uint32_t bits;
+	if (exp == 0) {
+		if (!man) {
+			bits = sign;
+		} else {
+			// subnormal half, normalize into a float
+			exp = 127 - 15 + 1;
+			while (!(man & 0x400)) {
+				man <<= 1;
+				exp--;
+			}
+			bits = sign | (exp << 23) | ((man & 0x3FF) << 13);
+		}
+	} else if (exp == 31) {
+		bits = sign | 0x7F800000 | (man << 13);
+	} else {
+		bits = sign | ((exp + 127 - 15) << 23) | (man << 13);
+	}
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static inline uint16_t float_to_half(float f) {
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	uint32_t sign = (x >> 16) & 0x8000;
+	uint32_t fexp = (x >> 23) & 0xFF;
+	uint32_t man = x & 0x7FFFFF;
+	int32_t exp = (int32_t)fexp - 127 + 15;
+	if (fexp == 0xFF)
+		return (uint16_t)(sign | 0x7C00 | (man ? 0x200 : 0));
+	if (exp >= 31)
+		return (uint16_t)(sign | 0x7C00);
+	if (exp <= 0) {
+		// subnormal (or zero) half
+		if (exp < -10)
+			return (uint16_t)sign;
+		man |= 0x800000;
+		uint32_t shift = (uint32_t)(14 - exp);
+		uint32_t h = man >> shift;
+		uint32_t rem = man & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+		if (rem > halfway || (rem == halfway && (h & 1)))
+			h++;
+		return (uint16_t)(sign | h);
+	}
+	uint32_t h = ((uint32_t)exp << 10) | (man >> 13);
+	uint32_t rem = man & 0x1FFF;
+	// a carry out of the mantissa correctly bumps the exponent (up to inf)
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++;
+	return (uint16_t)(sign | h);
+}
+
+// Quantize a real value into the 8-bit range [lo, hi] of a tensor
+static inline int quantize(float v, const tensor_fmt_t &fmt, int lo, int hi) {
+	int q = (int)lrintf(v / fmt.scale) + fmt.zero_point;
+	return q < lo ? lo : (q > hi ? hi : q);
+}
+
+#endif
@@ -0,0 +1,145 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "upsample.h"
+#include "blend.h"
+
+// BT.601 luma weights
+static const float wr = 0.299f, wg = 0.587f, wb = 0.114f;
+
+void gf_guide(const cv::Mat &prep, float scaling, float offset, cv::Size size, cv::Mat &guide, cv::Mat &small,
+	float kr, float kb) {
+	CV_Assert(prep.type() == CV_32FC3);
+	const float kg = 1.0f - kr - kb;
+	cv::resize(prep, small, size, 0, 0, cv::INTER_AREA);
+	guide.create(size, CV_32FC1);
+	// undo input normalization, back to [0,1]
+	const float k = 1.0f / (255.0f * scaling);
+	for (int y = 0; y < size.height; y++) {
+		const float *in = small.ptr<float>(y);
+		float *out = guide.ptr<float>(y);
+		for (int x = 0; x < size.width; x++, in += 3)
+			out[x] = (kr*in[0] + kg*in[1] + kb*in[2] - offset) * k;
+	}
+}
+
+void gf_coeffs(const cv::Mat &guide, const cv::Mat &mask, cv::Mat &a, cv::Mat &b, gf_scratch_t &tmp) {
+	CV_Assert(guide.type() == CV_32FC1 && mask.type() == CV_8UC1 && guide.size() == mask.size());
+	cv::Mat &p = tmp.p, &ip = tmp.ip, &ii = tmp.ii;
+	cv::Mat &mean_i = tmp.mean_i, &mean_p = tmp.mean_p, &mean_ip = tmp.mean_ip, &mean_ii = tmp.mean_ii;
+	mask.convertTo(p, CV_32F, 1.0/255.0);
+	cv::multiply(guide, p, ip);
+	cv::multiply(guide, guide, ii);
+	cv::Size box(2*GF_RADIUS+1, 2*GF_RADIUS+1);
+	cv::boxFilter(guide, mean_i, CV_32F, box);
+	cv::boxFilter(p, mean_p, CV_32F, box);
+	cv::boxFilter(ip, mean_ip, CV_32F, box);
+	cv::boxFilter(ii, mean_ii, CV_32F, box);
+	// per window: a = cov(I,p) / (var(I) + eps), b = mean(p) - a * mean(I)
+	a.create(guide.size(), CV_32FC1);
+	b.create(guide.size(), CV_32FC1);
+	for (int y = 0; y < guide.rows; y++) {
+		const float *mi = mean_i.ptr<float>(y), *mp = mean_p.ptr<float>(y);
+		const float *mip = mean_ip.ptr<float>(y), *mii = mean_ii.ptr<float>(y);
+		float *pa = a.ptr<float>(y), *pb = b.ptr<float>(y);
+		for (int x = 0; x < guide.cols; x++) {
+			float va = (mip[x] - mi[x]*mp[x]) / (mii[x] - mi[x]*mi[x] + GF_EPS);
+			pa[x] = va;
+			pb[x] = mp[x] - va*mi[x];
+		}
+	}
+	// average the coefficients of all windows covering each pixel (through
+	// the scratch buffers, box filtering in place would copy)
+	cv::boxFilter(a, mean_i, CV_32F, box);
+	cv::boxFilter(b, mean_p, CV_32F, box);
+	mean_i.copyTo(a);
+	mean_p.copyTo(b);
+}
+
+// Interpolate coefficient rows of map.y0/y1[dy] vertically into ra, rb
+static inline void coeff_rows(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, int dy, float *ra, float *rb) {
+	const float *a0 = a.ptr<float>(map.y0[dy]), *a1 = a.ptr<float>(map.y1[dy]);
+	const float *b0 = b.ptr<float>(map.y0[dy]), *b1 = b.ptr<float>(map.y1[dy]);
+	const float wy = map.yw[dy];
+	for (int sx = 0; sx < map.ssize.width; sx++) {
+		ra[sx] = a0[sx] + wy*(a1[sx] - a0[sx]);
+		rb[sx] = b0[sx] + wy*(b1[sx] - b0[sx]);
+	}
+}
+
+// Mask value (0-255) at output column dx of a row from the interpolated
+// coefficient rows and the BGR pixel there
+static inline int coeff_mask(const prep_map_t &map, const float *ra, const float *rb, int dx, const uint8_t *px) {
+	// luma weights with the 255 scaling of the guide folded in
+	const float kr = wr/255.0f, kg = wg/255.0f, kb = wb/255.0f;
+	const int x0 = map.x0[dx], x1 = map.x1[dx];
+	const float wx = map.xw[dx];
+	float va = ra[x0] + wx*(ra[x1] - ra[x0]);
+	float vb = rb[x0] + wx*(rb[x1] - rb[x0]);
+	int v = (int)lrintf((va*(kb*px[0] + kg*px[1] + kr*px[2]) + vb) * 255.0f);
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+void gf_apply(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &roi, cv::Mat &dst) {
+	CV_Assert(a.type() == CV_32FC1 && b.type() == CV_32FC1 && a.size() == map.ssize && b.size() == map.ssize);
+	CV_Assert(roi.type() == CV_8UC3 && dst.type() == CV_8UC1 && roi.size() == map.dsize && dst.size() == map.dsize);
+	cv::AutoBuffer<float> ra(map.ssize.width), rb(map.ssize.width);
+	for (int dy = 0; dy < map.dsize.height; dy++) {
+		// interpolate the coefficient rows vertically once per output row
+		coeff_rows(map, a, b, dy, ra.data(), rb.data());
+		const uint8_t *in = roi.ptr<uint8_t>(dy);
+		uint8_t *out = dst.ptr<uint8_t>(dy);
+		for (int dx = 0; dx < map.dsize.width; dx++, in += 3)
+			out[dx] = (uint8_t)coeff_mask(map, ra.data(), rb.data(), dx, in);
+	}
+}
+
+void gf_apply_luma(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &roi, cv::Mat &dst) {
+	CV_Assert(a.type() == CV_32FC1 && b.type() == CV_32FC1 && a.size() == map.ssize && b.size() == map.ssize);
+	CV_Assert((roi.type() == CV_8UC1 || roi.type() == CV_8UC2) && dst.type() == CV_8UC1);
+	CV_Assert(roi.size() == map.dsize && dst.size() == map.dsize);
+	// 16-235 to the [0,1] of the guide
+	const float k = 1.0f / 219.0f;
+	const int step = roi.channels();
+	cv::AutoBuffer<float> ra(map.ssize.width), rb(map.ssize.width);
+	for (int dy = 0; dy < map.dsize.height; dy++) {
+		coeff_rows(map, a, b, dy, ra.data(), rb.data());
+		const uint8_t *in = roi.ptr<uint8_t>(dy);
+		uint8_t *out = dst.ptr<uint8_t>(dy);
+		for (int dx = 0; dx < map.dsize.width; dx++, in += step) {
+			const int x0 = map.x0[dx], x1 = map.x1[dx];
+			const float wx = map.xw[dx];
+			float va = ra[x0] + wx*(ra[x1] - ra[x0]);
+			float vb = rb[x0] + wx*(rb[x1] - rb[x0]);
+			int v = (int)lrintf((va*k*(float)(in[0] - 16) + vb) * 255.0f);
+			out[dx] = (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+		}
+	}
+}
+
+void gf_blend(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &fg, const cv::Mat &bg, cv::Mat &out) {
+	gf_blend_rows(map, a, b, fg, bg, 0, map.dsize.height, out);
+}
+
+void gf_blend_rows(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &fg, const cv::Mat &bg, int y0, int y1, cv::Mat &out) {
+	CV_Assert(a.type() == CV_32FC1 && b.type() == CV_32FC1 && a.size() == map.ssize && b.size() == map.ssize);
+	CV_Assert(fg.type() == CV_8UC3 && bg.type() == CV_8UC3 && out.type() == CV_8UC3);
+	CV_Assert(fg.size() == map.dsize && bg.size() == map.dsize && out.cols == map.dsize.width);
+	CV_Assert(0 <= y0 && y0 <= y1 && y1 <= map.dsize.height && out.rows == y1 - y0);
+	cv::AutoBuffer<float> ra(map.ssize.width), rb(map.ssize.width);
+	cv::AutoBuffer<uint8_t> rm(map.dsize.width);
+	for (int dy = y0; dy < y1; dy++) {
+		coeff_rows(map, a, b, dy, ra.data(), rb.data());
+		const uint8_t *pf = fg.ptr<uint8_t>(dy);
+		// the whole mask row first, out may be fg
+		for (int dx = 0; dx < map.dsize.width; dx++)
+			rm[dx] = (uint8_t)coeff_mask(map, ra.data(), rb.data(), dx, pf + 3*dx);
+		blend_bgr(bg.ptr<uint8_t>(dy), pf, rm.data(), map.dsize.width, out.ptr<uint8_t>(dy - y0));
+	}
+}
@@ -0,0 +1,57 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _UPSAMPLE_H
+#define _UPSAMPLE_H
+
+#include <opencv2/core/core.hpp>
+
+#include "preprocess.h"
+
+// Edge-aware mask upsampling with a fast guided filter (He & Sun, 2015):
+// the linear coefficients relating mask to frame luma are fitted at model
+// resolution, then interpolated and applied to the full-size frame in a
+// single pass. Mask edges snap to image edges instead of being blurred.
+
+// box radius (at model resolution) and regularization of the fit
+#define GF_RADIUS 2
+#define GF_EPS 1e-3f
+
+// Intermediate (box filtered) images of the coefficient fit, kept between
+// calls so fitting allocates nothing
+struct gf_scratch_t {
+	cv::Mat p, ip, ii;
+	cv::Mat mean_i, mean_p, mean_ip, mean_ii;
+};
+
+// Low resolution guide: luma in [0,1] of a normalized RGB (32FC3) model
+// input region, scaled to the given (model output) size via small (scratch).
+// kr and kb are the luma weights of red and blue, those of the frame matrix
+// when the mask is applied to its own luma (gf_apply_luma).
+void gf_guide(const cv::Mat &prep, float scaling, float offset, cv::Size size, cv::Mat &guide, cv::Mat &small,
+	float kr = 0.299f, float kb = 0.114f);
+
+// Fit the guided filter coefficients (32FC1, mean A and B) of an 8-bit mask
+// against a guide of the same size
+void gf_coeffs(const cv::Mat &guide, const cv::Mat &mask, cv::Mat &a, cv::Mat &b, gf_scratch_t &tmp);
+
+// Apply the coefficients to a full resolution (8UC3, BGR) frame region:
+// dst = 255 * (A * luma + B), with A and B interpolated through map (from
+// coefficient size to dst size). dst is 8UC1 and may be a view.
+void gf_apply(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &roi, cv::Mat &dst);
+
+// As gf_apply, guided by limited range luma: roi is a luma plane (8UC1) or
+// packed YUYV (8UC2, luma first)
+void gf_apply_luma(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &roi, cv::Mat &dst);
+
+// As gf_apply, but blend instead of storing the mask (see blend_bgr), where
+// m is evaluated on the fly from the luma of fg.
+// fg, bg and out are 8UC3 views of map.dsize, out may be fg.
+void gf_blend(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &fg, const cv::Mat &bg, cv::Mat &out);
+
+// As gf_blend, for rows [y0, y1) of fg and bg only, written to out rows
+// 0 to y1 - y0 (out may be a stripe buffer)
+void gf_blend_rows(const prep_map_t &map, const cv::Mat &a, const cv::Mat &b, const cv::Mat &fg, const cv::Mat &bg, int y0, int y1, cv::Mat &out);
+
+#endif
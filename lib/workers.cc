@@ -0,0 +1,104 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "workers.h"
+
+struct run_t {
+	const std::function<void(size_t)> *task;
+	size_t tasks;
+	// next task to claim
+	std::atomic<size_t> next{0};
+	// workers inside the run (under lock)
+	size_t users = 0;
+};
+
+struct workers_t {
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	// runs with tasks possibly left to claim, oldest first
+	std::deque<run_t *> runs;
+	bool stop = false;
+};
+
+// claim and execute tasks of r until none are left
+static void drain(run_t &r) {
+	for (size_t i; (i = r.next.fetch_add(1)) < r.tasks; )
+		(*r.task)(i);
+}
+
+static void worker(workers_t *w) {
+	std::unique_lock<std::mutex> hold(w->lock);
+	for (;;) {
+		w->wake.wait(hold, [w] { return w->stop || !w->runs.empty(); });
+		if (w->stop)
+			return;
+		run_t *r = w->runs.front();
+		if (r->next.load() >= r->tasks) {
+			// all claimed, the owner finishes it
+			w->runs.pop_front();
+			continue;
+		}
+		r->users++;
+		hold.unlock();
+		drain(*r);
+		hold.lock();
+		if (!--r->users)
+			w->idle.notify_all();
+	}
+}
+
+workers_t *workers_new(size_t threads) {
+	workers_t *w = new workers_t;
+	for (size_t t = 0; t < threads; t++)
+		w->threads.emplace_back(worker, w);
+	return w;
+}
+
+void workers_delete(workers_t *w) {
+	if (!w)
+		return;
+	{
+		std::lock_guard<std::mutex> hold(w->lock);
+		w->stop = true;
+	}
+	w->wake.notify_all();
+	for (auto &t : w->threads)
+		t.join();
+	delete w;
+}
+
+void workers_run(workers_t *w, size_t tasks, const std::function<void(size_t)> &task) {
+	run_t r;
+	r.task = &task;
+	r.tasks = tasks;
+	if (!w || w->threads.empty() || tasks < 2) {
+		drain(r);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> hold(w->lock);
+		w->runs.push_back(&r);
+	}
+	if (tasks > 2)
+		w->wake.notify_all();
+	else
+		w->wake.notify_one();
+	drain(r);
+	// every task is claimed, wait for the workers still executing theirs
+	std::unique_lock<std::mutex> hold(w->lock);
+	auto it = std::find(w->runs.begin(), w->runs.end(), &r);
+	if (it != w->runs.end())
+		w->runs.erase(it);
+	w->idle.wait(hold, [&r] { return !r.users; });
+}
@@ -0,0 +1,27 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _WORKERS_H
+#define _WORKERS_H
+
+#include <stddef.h>
+#include <functional>
+
+// Persistent worker threads for splitting a frame into row bands. A run
+// posts its tasks to the pool and works on them itself as well; idle
+// workers claim the next unclaimed task of the oldest run, so bands are
+// balanced dynamically and several streams can share one pool.
+
+struct workers_t;
+
+// A pool with the given number of threads (0: runs happen on the caller)
+workers_t *workers_new(size_t threads);
+void workers_delete(workers_t *w);
+
+// Run task(i) for every i in [0, tasks), returning once all have finished.
+// w may be nullptr (everything runs on the caller). Tasks must not block
+// on each other.
+void workers_run(workers_t *w, size_t tasks, const std::function<void(size_t)> &task);
+
+#endif
@@ -0,0 +1,323 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#include <algorithm>
+
+#include "simd.h"
+#include "yuv.h"
+
+// pixels of a row converted per I420 chunk (even)
+#define YUV_I420_CHUNK 512
+
+// Kr/Kb of the standards, scaled to 219/255 (luma, Q8) and 224/255 (chroma,
+// Q7 as they apply to pixel pair sums), rounded so that chroma rows sum to
+// zero (grey stays at 128) and luma spans 16-235 exactly.
+const yuv_coeffs_t yuv_bt601 = { 66, 129, 25, -19, -37, 56, 56, -47, -9 };
+const yuv_coeffs_t yuv_bt709 = { 47, 157, 16, -13, -43, 56, 56, -51, -5 };
+
+static inline uint8_t luma(const uint8_t *p, const yuv_coeffs_t &k) {
+	return (uint8_t)(((k.yr*p[2] + k.yg*p[1] + k.yb*p[0] + 128) >> 8) + 16);
+}
+
+static inline uint8_t chroma(int rs, int gs, int bs, int16_t cr, int16_t cg, int16_t cb) {
+	// arithmetic shift, rounding towards -inf as the vector shifts do
+	return (uint8_t)(((cr*rs + cg*gs + cb*bs + 128) >> 8) + 128);
+}
+
+static void yuyv_scalar(const uint8_t *bgr, size_t n, const yuv_coeffs_t &k, uint8_t *out) {
+	for (size_t i = 0; i + 1 < n; i += 2, bgr += 6, out += 4) {
+		int bs = bgr[0] + bgr[3], gs = bgr[1] + bgr[4], rs = bgr[2] + bgr[5];
+		out[0] = luma(bgr, k);
+		out[1] = chroma(rs, gs, bs, k.ur, k.ug, k.ub);
+		out[2] = luma(bgr + 3, k);
+		out[3] = chroma(rs, gs, bs, k.vr, k.vg, k.vb);
+	}
+}
+
+static void nv12_scalar(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *uv) {
+	for (size_t i = 0; i + 1 < n; i += 2, bgr0 += 6, bgr1 += 6, y0 += 2, y1 += 2, uv += 2) {
+		y0[0] = luma(bgr0, k);
+		y0[1] = luma(bgr0 + 3, k);
+		y1[0] = luma(bgr1, k);
+		y1[1] = luma(bgr1 + 3, k);
+		// rounded mean of the pair sums of both rows
+		int bs = (bgr0[0] + bgr0[3] + bgr1[0] + bgr1[3] + 1) >> 1;
+		int gs = (bgr0[1] + bgr0[4] + bgr1[1] + bgr1[4] + 1) >> 1;
+		int rs = (bgr0[2] + bgr0[5] + bgr1[2] + bgr1[5] + 1) >> 1;
+		uv[0] = chroma(rs, gs, bs, k.ur, k.ug, k.ub);
+		uv[1] = chroma(rs, gs, bs, k.vr, k.vg, k.vb);
+	}
+}
+
+#if defined(BS_SIMD_X86)
+
+// Byte shuffles gathering the B, G and R bytes of 8 pixels into 16 bit
+// lanes: pixels 0-5 come from the first 16 bytes, 5-7 from bytes 8-23
+#define BGR_SHUFFLES \
+	const __m128i sb0 = _mm_setr_epi8(0, -1, 3, -1, 6, -1, 9, -1, 12, -1, 15, -1, -1, -1, -1, -1); \
+	const __m128i sb1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 10, -1, 13, -1); \
+	const __m128i sg0 = _mm_setr_epi8(1, -1, 4, -1, 7, -1, 10, -1, 13, -1, -1, -1, -1, -1, -1, -1); \
+	const __m128i sg1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, -1, 11, -1, 14, -1); \
+	const __m128i sr0 = _mm_setr_epi8(2, -1, 5, -1, 8, -1, 11, -1, 14, -1, -1, -1, -1, -1, -1, -1); \
+	const __m128i sr1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 9, -1, 12, -1, 15, -1)
+
+struct bgr16_sse41_t {
+	__m128i b, g, r;
+};
+
+// B, G, R of 8 pixels (24 bytes) as 16 bit lanes
+BS_TARGET_SSE41 static inline bgr16_sse41_t load8_sse41(const uint8_t *p) {
+	BGR_SHUFFLES;
+	__m128i lo = _mm_loadu_si128((const __m128i *)p);
+	__m128i hi = _mm_loadu_si128((const __m128i *)(p + 8));
+	return {
+		_mm_or_si128(_mm_shuffle_epi8(lo, sb0), _mm_shuffle_epi8(hi, sb1)),
+		_mm_or_si128(_mm_shuffle_epi8(lo, sg0), _mm_shuffle_epi8(hi, sg1)),
+		_mm_or_si128(_mm_shuffle_epi8(lo, sr0), _mm_shuffle_epi8(hi, sr1)),
+	};
+}
+
+BS_TARGET_SSE41 static inline __m128i luma_sse41(const bgr16_sse41_t &p, const yuv_coeffs_t &k) {
+	// at most 220 * 255 + 128, fits unsigned 16 bit lanes
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(p.r, _mm_set1_epi16(k.yr)), _mm_mullo_epi16(p.g, _mm_set1_epi16(k.yg)));
+	t = _mm_add_epi16(t, _mm_add_epi16(_mm_mullo_epi16(p.b, _mm_set1_epi16(k.yb)), _mm_set1_epi16(128)));
+	return _mm_add_epi16(_mm_srli_epi16(t, 8), _mm_set1_epi16(16));
+}
+
+BS_TARGET_SSE41 static inline __m128i chroma_sse41(const bgr16_sse41_t &s, int16_t cr, int16_t cg, int16_t cb) {
+	// pair sums times half scale coefficients stay within +-56 * 510
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(s.r, _mm_set1_epi16(cr)), _mm_mullo_epi16(s.g, _mm_set1_epi16(cg)));
+	t = _mm_add_epi16(t, _mm_add_epi16(_mm_mullo_epi16(s.b, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+	return _mm_add_epi16(_mm_srai_epi16(t, 8), _mm_set1_epi16(128));
+}
+
+// pixel pair sums of 16 pixels
+BS_TARGET_SSE41 static inline bgr16_sse41_t pairs_sse41(const bgr16_sse41_t &a, const bgr16_sse41_t &b) {
+	return { _mm_hadd_epi16(a.b, b.b), _mm_hadd_epi16(a.g, b.g), _mm_hadd_epi16(a.r, b.r) };
+}
+
+BS_TARGET_SSE41 static void yuyv_sse41(const uint8_t *bgr, size_t n, const yuv_coeffs_t &k, uint8_t *out) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		bgr16_sse41_t a = load8_sse41(bgr + 3*i), b = load8_sse41(bgr + 3*i + 24);
+		__m128i y = _mm_packus_epi16(luma_sse41(a, k), luma_sse41(b, k));
+		bgr16_sse41_t s = pairs_sse41(a, b);
+		__m128i u = chroma_sse41(s, k.ur, k.ug, k.ub), v = chroma_sse41(s, k.vr, k.vg, k.vb);
+		__m128i uv = _mm_unpacklo_epi8(_mm_packus_epi16(u, u), _mm_packus_epi16(v, v));
+		_mm_storeu_si128((__m128i *)(out + 2*i), _mm_unpacklo_epi8(y, uv));
+		_mm_storeu_si128((__m128i *)(out + 2*i + 16), _mm_unpackhi_epi8(y, uv));
+	}
+	yuyv_scalar(bgr + 3*i, n - i, k, out + 2*i);
+}
+
+BS_TARGET_SSE41 static void nv12_sse41(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *uv) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		bgr16_sse41_t a0 = load8_sse41(bgr0 + 3*i), b0 = load8_sse41(bgr0 + 3*i + 24);
+		bgr16_sse41_t a1 = load8_sse41(bgr1 + 3*i), b1 = load8_sse41(bgr1 + 3*i + 24);
+		_mm_storeu_si128((__m128i *)(y0 + i), _mm_packus_epi16(luma_sse41(a0, k), luma_sse41(b0, k)));
+		_mm_storeu_si128((__m128i *)(y1 + i), _mm_packus_epi16(luma_sse41(a1, k), luma_sse41(b1, k)));
+		bgr16_sse41_t s0 = pairs_sse41(a0, b0), s1 = pairs_sse41(a1, b1);
+		bgr16_sse41_t s = { _mm_avg_epu16(s0.b, s1.b), _mm_avg_epu16(s0.g, s1.g), _mm_avg_epu16(s0.r, s1.r) };
+		__m128i u = chroma_sse41(s, k.ur, k.ug, k.ub), v = chroma_sse41(s, k.vr, k.vg, k.vb);
+		_mm_storeu_si128((__m128i *)(uv + i), _mm_unpacklo_epi8(_mm_packus_epi16(u, u), _mm_packus_epi16(v, v)));
+	}
+	nv12_scalar(bgr0 + 3*i, bgr1 + 3*i, n - i, k, y0 + i, y1 + i, uv + i);
+}
+
+struct bgr16_avx2_t {
+	__m256i b, g, r;
+};
+
+BS_TARGET_AVX2 static inline __m256i gather_avx2(__m256i lo, __m256i hi, __m128i s0, __m128i s1) {
+	return _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_broadcastsi128_si256(s0)),
+		_mm256_shuffle_epi8(hi, _mm256_broadcastsi128_si256(s1)));
+}
+
+// B, G, R of 16 pixels (48 bytes) as 16 bit lanes, pixels 0-7 in the low
+// and 8-15 in the high 128 bit lane
+BS_TARGET_AVX2 static inline bgr16_avx2_t load16_avx2(const uint8_t *p) {
+	BGR_SHUFFLES;
+	__m256i lo = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+		_mm_loadu_si128((const __m128i *)(p + 24)), 1);
+	__m256i hi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p + 8))),
+		_mm_loadu_si128((const __m128i *)(p + 32)), 1);
+	return { gather_avx2(lo, hi, sb0, sb1), gather_avx2(lo, hi, sg0, sg1), gather_avx2(lo, hi, sr0, sr1) };
+}
+
+BS_TARGET_AVX2 static inline __m256i luma_avx2(const bgr16_avx2_t &p, const yuv_coeffs_t &k) {
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(p.r, _mm256_set1_epi16(k.yr)), _mm256_mullo_epi16(p.g, _mm256_set1_epi16(k.yg)));
+	t = _mm256_add_epi16(t, _mm256_add_epi16(_mm256_mullo_epi16(p.b, _mm256_set1_epi16(k.yb)), _mm256_set1_epi16(128)));
+	return _mm256_add_epi16(_mm256_srli_epi16(t, 8), _mm256_set1_epi16(16));
+}
+
+BS_TARGET_AVX2 static inline __m256i chroma_avx2(const bgr16_avx2_t &s, int16_t cr, int16_t cg, int16_t cb) {
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(s.r, _mm256_set1_epi16(cr)), _mm256_mullo_epi16(s.g, _mm256_set1_epi16(cg)));
+	t = _mm256_add_epi16(t, _mm256_add_epi16(_mm256_mullo_epi16(s.b, _mm256_set1_epi16(cb)), _mm256_set1_epi16(128)));
+	return _mm256_add_epi16(_mm256_srai_epi16(t, 8), _mm256_set1_epi16(128));
+}
+
+// pixel pair sums of 32 pixels, in-lane: pairs 0-3, 8-11 | 4-7, 12-15
+BS_TARGET_AVX2 static inline bgr16_avx2_t pairs_avx2(const bgr16_avx2_t &a, const bgr16_avx2_t &b) {
+	return { _mm256_hadd_epi16(a.b, b.b), _mm256_hadd_epi16(a.g, b.g), _mm256_hadd_epi16(a.r, b.r) };
+}
+
+// the 128 bit lane interleaving of the packs puts 64 bit quarters 1 and 2
+// out of order, swap them back
+#define QUARTERS_IN_ORDER 0xD8
+
+// luma bytes of 32 pixels in order
+BS_TARGET_AVX2 static inline __m256i luma32_avx2(const bgr16_avx2_t &a, const bgr16_avx2_t &b, const yuv_coeffs_t &k) {
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(luma_avx2(a, k), luma_avx2(b, k)), QUARTERS_IN_ORDER);
+}
+
+// interleaved Cb Cr bytes of the 16 pixel pairs in order
+BS_TARGET_AVX2 static inline __m256i chroma32_avx2(const bgr16_avx2_t &s, const yuv_coeffs_t &k) {
+	__m256i u = chroma_avx2(s, k.ur, k.ug, k.ub), v = chroma_avx2(s, k.vr, k.vg, k.vb);
+	__m256i uv = _mm256_unpacklo_epi8(_mm256_packus_epi16(u, u), _mm256_packus_epi16(v, v));
+	return _mm256_permute4x64_epi64(uv, QUARTERS_IN_ORDER);
+}
+
+BS_TARGET_AVX2 static void yuyv_avx2(const uint8_t *bgr, size_t n, const yuv_coeffs_t &k, uint8_t *out) {
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		bgr16_avx2_t a = load16_avx2(bgr + 3*i), b = load16_avx2(bgr + 3*i + 48);
+		__m256i y = luma32_avx2(a, b, k);
+		__m256i uv = chroma32_avx2(pairs_avx2(a, b), k);
+		// in-lane interleave: pixels 0-7 | 16-23 and 8-15 | 24-31
+		__m256i lo = _mm256_unpacklo_epi8(y, uv), hi = _mm256_unpackhi_epi8(y, uv);
+		_mm256_storeu_si256((__m256i *)(out + 2*i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(out + 2*i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	yuyv_sse41(bgr + 3*i, n - i, k, out + 2*i);
+}
+
+BS_TARGET_AVX2 static void nv12_avx2(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *uv) {
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		bgr16_avx2_t a0 = load16_avx2(bgr0 + 3*i), b0 = load16_avx2(bgr0 + 3*i + 48);
+		bgr16_avx2_t a1 = load16_avx2(bgr1 + 3*i), b1 = load16_avx2(bgr1 + 3*i + 48);
+		_mm256_storeu_si256((__m256i *)(y0 + i), luma32_avx2(a0, b0, k));
+		_mm256_storeu_si256((__m256i *)(y1 + i), luma32_avx2(a1, b1, k));
+		bgr16_avx2_t s0 = pairs_avx2(a0, b0), s1 = pairs_avx2(a1, b1);
+		bgr16_avx2_t s = { _mm256_avg_epu16(s0.b, s1.b), _mm256_avg_epu16(s0.g, s1.g), _mm256_avg_epu16(s0.r, s1.r) };
+		_mm256_storeu_si256((__m256i *)(uv + i), chroma32_avx2(s, k));
+	}
+	nv12_sse41(bgr0 + 3*i, bgr1 + 3*i, n - i, k, y0 + i, y1 + i, uv + i);
+}
+
+#endif // BS_SIMD_X86
+
+#if defined(BS_SIMD_NEON)
+
+static inline uint8x16_t luma_neon(const uint8x16x3_t &p, const yuv_coeffs_t &k) {
+	const uint8x8_t yr = vdup_n_u8((uint8_t)k.yr), yg = vdup_n_u8((uint8_t)k.yg), yb = vdup_n_u8((uint8_t)k.yb);
+	uint16x8_t lo = vmlal_u8(vmlal_u8(vmull_u8(vget_low_u8(p.val[2]), yr), vget_low_u8(p.val[1]), yg), vget_low_u8(p.val[0]), yb);
+	uint16x8_t hi = vmlal_u8(vmlal_u8(vmull_u8(vget_high_u8(p.val[2]), yr), vget_high_u8(p.val[1]), yg), vget_high_u8(p.val[0]), yb);
+	uint8x16_t y = vcombine_u8(vshrn_n_u16(vaddq_u16(lo, vdupq_n_u16(128)), 8), vshrn_n_u16(vaddq_u16(hi, vdupq_n_u16(128)), 8));
+	return vaddq_u8(y, vdupq_n_u8(16));
+}
+
+// s: pixel pair sums of B, G, R
+static inline uint8x8_t chroma_neon(const int16x8_t s[3], int16_t cr, int16_t cg, int16_t cb) {
+	int16x8_t t = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(s[2], cr), s[1], cg), s[0], cb);
+	t = vshrq_n_s16(vaddq_s16(t, vdupq_n_s16(128)), 8);
+	return vqmovun_s16(vaddq_s16(t, vdupq_n_s16(128)));
+}
+
+static void yuyv_neon(const uint8_t *bgr, size_t n, const yuv_coeffs_t &k, uint8_t *out) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x3_t p = vld3q_u8(bgr + 3*i);
+		uint8x16_t y = luma_neon(p, k);
+		int16x8_t s[3];
+		for (int c = 0; c < 3; c++)
+			s[c] = vreinterpretq_s16_u16(vpaddlq_u8(p.val[c]));
+		// even and odd luma around the chroma pair
+		uint8x8x2_t yy = vuzp_u8(vget_low_u8(y), vget_high_u8(y));
+		uint8x8x4_t o = { { yy.val[0], chroma_neon(s, k.ur, k.ug, k.ub), yy.val[1], chroma_neon(s, k.vr, k.vg, k.vb) } };
+		vst4_u8(out + 2*i, o);
+	}
+	yuyv_scalar(bgr + 3*i, n - i, k, out + 2*i);
+}
+
+static void nv12_neon(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *uv) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x3_t p0 = vld3q_u8(bgr0 + 3*i);
+		uint8x16x3_t p1 = vld3q_u8(bgr1 + 3*i);
+		vst1q_u8(y0 + i, luma_neon(p0, k));
+		vst1q_u8(y1 + i, luma_neon(p1, k));
+		int16x8_t s[3];
+		for (int c = 0; c < 3; c++)
+			s[c] = vreinterpretq_s16_u16(vrhaddq_u16(vpaddlq_u8(p0.val[c]), vpaddlq_u8(p1.val[c])));
+		uint8x8x2_t o = { { chroma_neon(s, k.ur, k.ug, k.ub), chroma_neon(s, k.vr, k.vg, k.vb) } };
+		vst2_u8(uv + i, o);
+	}
+	nv12_scalar(bgr0 + 3*i, bgr1 + 3*i, n - i, k, y0 + i, y1 + i, uv + i);
+}
+
+#endif // BS_SIMD_NEON
+
+// Dispatchers
+
+void yuv_yuyv_row(const uint8_t *bgr, size_t n, const yuv_coeffs_t &k, uint8_t *out) {
+	switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+		case simd_level_t::AVX2:
+			yuyv_avx2(bgr, n, k, out);
+			return;
+		case simd_level_t::SSE41:
+			yuyv_sse41(bgr, n, k, out);
+			return;
+#endif
+#if defined(BS_SIMD_NEON)
+		case simd_level_t::NEON:
+			yuyv_neon(bgr, n, k, out);
+			return;
+#endif
+		default:
+			yuyv_scalar(bgr, n, k, out);
+	}
+}
+
+void yuv_nv12_rows(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *uv) {
+	switch (simd_level()) {
+#if defined(BS_SIMD_X86)
+		case simd_level_t::AVX2:
+			nv12_avx2(bgr0, bgr1, n, k, y0, y1, uv);
+			return;
+		case simd_level_t::SSE41:
+			nv12_sse41(bgr0, bgr1, n, k, y0, y1, uv);
+			return;
+#endif
+#if defined(BS_SIMD_NEON)
+		case simd_level_t::NEON:
+			nv12_neon(bgr0, bgr1, n, k, y0, y1, uv);
+			return;
+#endif
+		default:
+			nv12_scalar(bgr0, bgr1, n, k, y0, y1, uv);
+	}
+}
+
+// I420 through the NV12 kernels, a chunk at a time so the interleaved
+// chroma is split while still in L1
+void yuv_i420_rows(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+	uint8_t uv[YUV_I420_CHUNK];
+	for (size_t x = 0; x < n; x += YUV_I420_CHUNK) {
+		const size_t c = std::min((size_t)YUV_I420_CHUNK, n - x);
+		yuv_nv12_rows(bgr0 + 3*x, bgr1 + 3*x, c, k, y0 + x, y1 + x, uv);
+		for (size_t i = 0; i < c / 2; i++) {
+			u[x/2 + i] = uv[2*i];
+			v[x/2 + i] = uv[2*i + 1];
+		}
+	}
+}
@@ -0,0 +1,39 @@
+/* This is licenced software, @see LICENSE file.
+ * Authors - @see AUTHORS file.
+==============================================================================*/
+
+#ifndef _YUV_H
+#define _YUV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Single pass BGR to limited range (16-235/240) Y'CbCr conversion for the
+// video output, writing the packed/(semi-)planar layouts directly.
+//   Y  = ((yr*R + yg*G + yb*B + 128) >> 8) + 16
+//   Cb = ((ur*Rs + ug*Gs + ub*Bs + 128) >> 8) + 128
+// with Rs, Gs, Bs the sums of the two pixels sharing a chroma sample
+// (rounded mean of two such sums for 4:2:0), so chroma coefficients are
+// half scale. All kernel variants produce identical bytes.
+
+struct yuv_coeffs_t {
+	int16_t yr, yg, yb;
+	int16_t ur, ug, ub;
+	int16_t vr, vg, vb;
+};
+
+extern const yuv_coeffs_t yuv_bt601, yuv_bt709;
+
+// One row of n (even) BGR pixels to YUYV (Y0 Cb Y1 Cr), 2n bytes
+void yuv_yuyv_row(const uint8_t *bgr, size_t n, const yuv_coeffs_t &k, uint8_t *out);
+
+// Two rows of n (even) BGR pixels to two rows of luma and one row of
+// interleaved Cb Cr (NV12), n bytes each
+void yuv_nv12_rows(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *uv);
+
+// As above into planar I420, n / 2 bytes of Cb and Cr each
+void yuv_i420_rows(const uint8_t *bgr0, const uint8_t *bgr1, size_t n, const yuv_coeffs_t &k,
+	uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v);
+
+#endif
@@ -0,0 +1,347 @@
+/* This is licensed software, @see LICENSE file.
+ * Authors - @see AUTHORS file. */
+
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <vector>
+
+#include "capture.h"
+
+struct capture_map_t {
+	uint8_t *data;
+	size_t length;
+};
+
+struct capture_t {
+	int fd = -1;
+	// file stand-in: one mapping of the whole file, else one per buffer
+	bool file = false;
+	std::vector<capture_map_t> maps;
+	int width = 0;
+	int height = 0;
+	uint32_t pixfmt = 0;
+	size_t stride = 0;
+	size_t size = 0;
+	// frames in the file, frames handed out
+	size_t frames = 0;
+	uint64_t count = 0;
+	// sequence number of the last frame dequeued (-1: none yet)
+	int64_t last = -1;
+	uint64_t dropped = 0;
+};
+
+// ioctl restarted when interrupted by a signal
+static int xioctl(int fd, unsigned long req, void *arg) {
+	int ret;
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+// bytes per line and per frame of the formats a file may hold
+static bool frame_layout(uint32_t pixfmt, int w, int h, size_t &linewidth, size_t &framesize) {
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_YUYV:
+		linewidth = w * 2;
+		framesize = h * linewidth;
+		return true;
+	case V4L2_PIX_FMT_NV12:
+		linewidth = w;
+		framesize = h * linewidth * 3 / 2;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void capture_free(capture_t *c) {
+	for (auto &m : c->maps)
+		munmap(m.data, m.length);
+	if (!c->file && c->fd >= 0) {
+		struct v4l2_requestbuffers req;
+		memset(&req, 0, sizeof(req));
+		req.count = 0;
+		req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		req.memory = V4L2_MEMORY_MMAP;
+		xioctl(c->fd, VIDIOC_REQBUFS, &req);
+	}
+	if (c->fd >= 0)
+		close(c->fd);
+	delete c;
+}
+
+static bool open_file(capture_t *c, const std::string& path, off_t bytes) {
+	if (c->width <= 0 || c->height <= 0 || !frame_layout(c->pixfmt, c->width, c->height, c->stride, c->size)) {
+		fprintf(stderr, "%s:%d(%s): Raw frame file needs a geometry and YUYV or NV12: %s\n", __FILE__, __LINE__, __func__, path.c_str());
+		return false;
+	}
+	c->frames = bytes / c->size;
+	if (!c->frames) {
+		fprintf(stderr, "%s:%d(%s): No whole frame in %s\n", __FILE__, __LINE__, __func__, path.c_str());
+		return false;
+	}
+	void *data = mmap(nullptr, c->frames * c->size, PROT_READ, MAP_PRIVATE, c->fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "%s:%d(%s): Failed to map %s: %s\n", __FILE__, __LINE__, __func__, path.c_str(), strerror(errno));
+		return false;
+	}
+	c->maps.push_back({ (uint8_t *)data, c->frames * c->size });
+	return true;
+}
+
+static bool open_device(capture_t *c, const std::string& device, size_t count) {
+	struct v4l2_capability vid_caps;
+	if (xioctl(c->fd, VIDIOC_QUERYCAP, &vid_caps) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to query device capabilities: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	uint32_t caps = (vid_caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? vid_caps.device_caps : vid_caps.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING)) {
+		fprintf(stderr, "%s:%d(%s): %s is no streaming capture device\n", __FILE__, __LINE__, __func__, device.c_str());
+		return false;
+	}
+
+	struct v4l2_format vid_format;
+	memset(&vid_format, 0, sizeof(vid_format));
+	vid_format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	vid_format.fmt.pix.width = c->width;
+	vid_format.fmt.pix.height = c->height;
+	vid_format.fmt.pix.pixelformat = c->pixfmt;
+	vid_format.fmt.pix.field = V4L2_FIELD_NONE;
+	if (xioctl(c->fd, VIDIOC_S_FMT, &vid_format) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to set device video format: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	// S_FMT adjusts what it does not support rather than failing
+	if (vid_format.fmt.pix.pixelformat != c->pixfmt) {
+		fprintf(stderr, "%s:%d(%s): Device does not support capture format %.4s\n", __FILE__, __LINE__, __func__,
+			(const char *)&c->pixfmt);
+		return false;
+	}
+	c->width = vid_format.fmt.pix.width;
+	c->height = vid_format.fmt.pix.height;
+	c->stride = vid_format.fmt.pix.bytesperline;
+	c->size = vid_format.fmt.pix.sizeimage;
+
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = count;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(c->fd, VIDIOC_REQBUFS, &req) < 0 || !req.count) {
+		fprintf(stderr, "%s:%d(%s): Failed to request buffers: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	for (unsigned i = 0; i < req.count; i++) {
+		struct v4l2_buffer vb;
+		memset(&vb, 0, sizeof(vb));
+		vb.index = i;
+		vb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		vb.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(c->fd, VIDIOC_QUERYBUF, &vb) < 0) {
+			fprintf(stderr, "%s:%d(%s): Failed to query buffer %u: %s\n", __FILE__, __LINE__, __func__, i, strerror(errno));
+			return false;
+		}
+		void *data = mmap(nullptr, vb.length, PROT_READ|PROT_WRITE, MAP_SHARED, c->fd, vb.m.offset);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "%s:%d(%s): Failed to map buffer %u: %s\n", __FILE__, __LINE__, __func__, i, strerror(errno));
+			return false;
+		}
+		c->maps.push_back({ (uint8_t *)data, vb.length });
+		if (xioctl(c->fd, VIDIOC_QBUF, &vb) < 0) {
+			fprintf(stderr, "%s:%d(%s): Failed to queue buffer %u: %s\n", __FILE__, __LINE__, __func__, i, strerror(errno));
+			return false;
+		}
+	}
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(c->fd, VIDIOC_STREAMON, &type) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to start streaming: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void *capture_open(const std::string& device, int &w, int &h, uint32_t pixfmt, size_t count, int debug) {
+	capture_t *c = new capture_t;
+	c->width = w;
+	c->height = h;
+	c->pixfmt = pixfmt;
+	c->fd = open(device.c_str(), O_RDWR|O_NONBLOCK|O_CLOEXEC);
+	if (c->fd < 0)
+		c->fd = open(device.c_str(), O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	struct stat st;
+	if (c->fd < 0 || fstat(c->fd, &st) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to open %s: %s\n", __FILE__, __LINE__, __func__, device.c_str(), strerror(errno));
+		capture_free(c);
+		return nullptr;
+	}
+	c->file = S_ISREG(st.st_mode);
+	if (!(c->file ? open_file(c, device, st.st_size) : open_device(c, device, count))) {
+		capture_free(c);
+		return nullptr;
+	}
+	if (debug)
+		printf("capture: %s %dx%d %.4s, %zu %s\n", device.c_str(), c->width, c->height, (const char *)&c->pixfmt,
+			c->file ? c->frames : c->maps.size(), c->file ? "frames in file" : "mmap buffers");
+	w = c->width;
+	h = c->height;
+	return c;
+}
+
+void capture_close(void *capture) {
+	capture_t *c = (capture_t *)capture;
+	if (!c)
+		return;
+	if (!c->file) {
+		v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		xioctl(c->fd, VIDIOC_STREAMOFF, &type);
+	}
+	capture_free(c);
+}
+
+static void requeue(capture_t *c, struct v4l2_buffer &vb) {
+	if (xioctl(c->fd, VIDIOC_QBUF, &vb) < 0)
+		fprintf(stderr, "%s:%d(%s): Failed to queue buffer %u: %s\n", __FILE__, __LINE__, __func__, vb.index, strerror(errno));
+}
+
+bool capture_grab(void *capture, capture_frame_t &frame, int timeout) {
+	capture_t *c = (capture_t *)capture;
+	if (!c)
+		return false;
+	frame.width = c->width;
+	frame.height = c->height;
+	frame.pixfmt = c->pixfmt;
+	frame.stride = c->stride;
+	if (c->file) {
+		frame.data = c->maps[0].data + (c->count % c->frames) * c->size;
+		frame.size = c->size;
+		frame.sequence = (uint32_t)c->count++;
+		frame.index = 0;
+		clock_gettime(CLOCK_MONOTONIC, &frame.ts);
+		return true;
+	}
+
+	struct pollfd pfd = { c->fd, POLLIN, 0 };
+	int ret = poll(&pfd, 1, timeout);
+	if (ret <= 0) {
+		if (ret < 0 && errno != EINTR)
+			fprintf(stderr, "%s:%d(%s): Failed to wait for a frame: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	// dequeue everything ready, keeping the newest
+	struct v4l2_buffer vb;
+	bool got = false;
+	for (;;) {
+		struct v4l2_buffer b;
+		memset(&b, 0, sizeof(b));
+		b.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		b.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(c->fd, VIDIOC_DQBUF, &b) < 0) {
+			if (errno != EAGAIN)
+				fprintf(stderr, "%s:%d(%s): Failed to dequeue buffer: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+			break;
+		}
+		if (c->last >= 0 && b.sequence > c->last + 1)
+			c->dropped += b.sequence - c->last - 1;
+		c->last = b.sequence;
+		if (b.index >= c->maps.size() || (b.flags & V4L2_BUF_FLAG_ERROR)) {
+			requeue(c, b);
+			c->dropped++;
+			continue;
+		}
+		if (got) {
+			requeue(c, vb);
+			c->dropped++;
+		}
+		vb = b;
+		got = true;
+	}
+	if (!got)
+		return false;
+
+	frame.data = c->maps[vb.index].data;
+	frame.size = vb.bytesused ? vb.bytesused : c->size;
+	frame.sequence = vb.sequence;
+	frame.index = vb.index;
+	if ((vb.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+		frame.ts.tv_sec = vb.timestamp.tv_sec;
+		frame.ts.tv_nsec = vb.timestamp.tv_usec * 1000;
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &frame.ts);
+	}
+	return true;
+}
+
+void capture_release(void *capture, capture_frame_t &frame) {
+	capture_t *c = (capture_t *)capture;
+	if (!c || frame.index < 0)
+		return;
+	if (!c->file) {
+		struct v4l2_buffer vb;
+		memset(&vb, 0, sizeof(vb));
+		vb.index = frame.index;
+		vb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		vb.memory = V4L2_MEMORY_MMAP;
+		requeue(c, vb);
+	}
+	frame.data = nullptr;
+	frame.index = -1;
+}
+
+uint64_t capture_dropped(void *capture) {
+	capture_t *c = (capture_t *)capture;
+	return c ? c->dropped : 0;
+}
+
+#ifdef standalone
+
+int main(int argc, char* argv[]) {
+
+	std::string video_device("/dev/video0");
+	int w = 640, h = 480;
+
+	if(argc>1) {
+		video_device=argv[1];
+		printf("using capture device: %s\n", video_device.c_str());
+	}
+	if(argc>3) {
+		w = atoi(argv[2]);
+		h = atoi(argv[3]);
+	}
+
+	void *cap = capture_open(video_device, w, h, V4L2_PIX_FMT_YUYV, 2, 1);
+	if(!cap) {
+		fprintf(stderr, "Failed to initialize capture device %s\n", video_device.c_str());
+		exit(1);
+	}
+
+	for (int n = 0; n < 100; n++) {
+		capture_frame_t frame;
+		if (!capture_grab(cap, frame, 1000)) {
+			fprintf(stderr, "no frame\n");
+			continue;
+		}
+		printf("seq %6u ts %ld.%06ld size %zu dropped %lu\n", frame.sequence, (long)frame.ts.tv_sec,
+			frame.ts.tv_nsec / 1000, frame.size, (unsigned long)capture_dropped(cap));
+		capture_release(cap, frame);
+	}
+
+	capture_close(cap);
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/* This is licensed software, @see LICENSE file.
+ * Authors - @see AUTHORS file. */
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <linux/videodev2.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+// Native V4L2 capture: frames stay in driver buffers mapped into our
+// address space and are handed out as views, stamped by the kernel. A
+// regular file of raw frames stands in for a device (eg: for testing),
+// its frames are handed out in a loop.
+
+// A captured frame, valid until released
+struct capture_frame_t {
+	const uint8_t *data = nullptr;
+	// bytes of the frame, of a (first plane) row
+	size_t size = 0;
+	size_t stride = 0;
+	int width = 0;
+	int height = 0;
+	uint32_t pixfmt = 0;
+	// capture time (CLOCK_MONOTONIC) and driver frame counter
+	struct timespec ts = {};
+	uint32_t sequence = 0;
+	int index = -1;
+};
+
+// Open device for capture in pixfmt (V4L2_PIX_FMT_YUYV or NV12) with count
+// driver buffers (fewer: less latency, more drops when we fall behind).
+// w and h ask for a geometry and return the one the driver chose, a file
+// stand-in needs them as stored. Returns nullptr on failure.
+void *capture_open(const std::string& device, int &w, int &h, uint32_t pixfmt, size_t count, int debug);
+void capture_close(void *capture);
+
+// Wait up to timeout ms for a frame. When several are ready, the newest is
+// returned and the others go back to the driver as dropped.
+bool capture_grab(void *capture, capture_frame_t &frame, int timeout);
+// Give the buffer of frame back to the driver
+void capture_release(void *capture, capture_frame_t &frame);
+
+// Frames lost so far: skipped by the driver (sequence gaps) or by
+// capture_grab (stale)
+uint64_t capture_dropped(void *capture);
+
+#endif // _CAPTURE_H_
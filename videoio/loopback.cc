@@ -3,7 +3,9 @@
 
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,6 +14,8 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include <vector>
+
 #include "loopback.h"
 
 void print_format(struct v4l2_format*vid_format) {
@@ -23,16 +27,43 @@ void print_format(struct v4l2_format*vid_format) {
 	printf("vid_format->fmt.pix.field       = %d\n",	vid_format->fmt.pix.field );
 	printf("vid_format->fmt.pix.bytesperline= %d\n",	vid_format->fmt.pix.bytesperline );
 	printf("vid_format->fmt.pix.colorspace  = %d\n",	vid_format->fmt.pix.colorspace );
+	printf("vid_format->fmt.pix.ycbcr_enc   = %d\n",	vid_format->fmt.pix.ycbcr_enc );
+	printf("vid_format->fmt.pix.quantization= %d\n",	vid_format->fmt.pix.quantization );
 	printf("\n");
 }
 
-int loopback_init(const std::string& device, int w, int h, int debug) {
+// bytes per line and per frame of the single planar layouts
+static bool frame_layout(uint32_t pixfmt, int w, int h, size_t &linewidth, size_t &framesize) {
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_YUYV:
+		linewidth = w * 2;
+		framesize = h * linewidth;
+		return true;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUV420:
+		linewidth = w;
+		framesize = h * linewidth * 3 / 2;
+		return true;
+	case V4L2_PIX_FMT_RGB24:
+		linewidth = w * 3;
+		framesize = h * linewidth;
+		return true;
+	default:
+		return false;
+	}
+}
+
+int loopback_init(const std::string& device, int w, int h, int debug, bool bt709, uint32_t pixfmt) {
 
 	struct v4l2_capability vid_caps;
 	struct v4l2_format vid_format;
 
-	size_t linewidth = w * 2;
-	size_t framesize = h * linewidth;
+	size_t linewidth, framesize;
+	if (!frame_layout(pixfmt, w, h, linewidth, framesize)) {
+		fprintf(stderr, "%s:%d(%s): Unsupported output format: %.4s\n", __FILE__, __LINE__, __func__, (const char *)&pixfmt);
+		return -1;
+	}
+	const bool rgb = V4L2_PIX_FMT_RGB24 == pixfmt;
 
 	int ret_code;
 
@@ -53,11 +84,18 @@ int loopback_init(const std::string& device, int w, int h, int debug) {
 	vid_format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
 	vid_format.fmt.pix.width = w;
 	vid_format.fmt.pix.height = h;
-	vid_format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	vid_format.fmt.pix.pixelformat = pixfmt;
 	vid_format.fmt.pix.sizeimage = framesize;
 	vid_format.fmt.pix.field = V4L2_FIELD_NONE;
 	vid_format.fmt.pix.bytesperline = linewidth;
-	vid_format.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+	if (rgb) {
+		vid_format.fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+		vid_format.fmt.pix.quantization = V4L2_QUANTIZATION_FULL_RANGE;
+	} else {
+		vid_format.fmt.pix.colorspace = bt709 ? V4L2_COLORSPACE_REC709 : V4L2_COLORSPACE_SMPTE170M;
+		vid_format.fmt.pix.ycbcr_enc = bt709 ? V4L2_YCBCR_ENC_709 : V4L2_YCBCR_ENC_601;
+		vid_format.fmt.pix.quantization = V4L2_QUANTIZATION_LIM_RANGE;
+	}
 
 	ret_code = ioctl(fdwr, VIDIOC_S_FMT, &vid_format);
 	if(ret_code < 0) {
@@ -65,6 +103,13 @@ int loopback_init(const std::string& device, int w, int h, int debug) {
 		close(fdwr);
 		return -1;
 	}
+	// S_FMT adjusts what it does not support rather than failing
+	if (vid_format.fmt.pix.pixelformat != pixfmt) {
+		fprintf(stderr, "%s:%d(%s): Device does not support output format %.4s\n", __FILE__, __LINE__, __func__,
+			(const char *)&pixfmt);
+		close(fdwr);
+		return -1;
+	}
 
 	ret_code = ioctl(fdwr, VIDIOC_STREAMON, &vid_format.type);
 
@@ -100,6 +145,160 @@ int loopback_free(int fdwr) {
 	return 0;
 }
 
+struct loopback_stream_t {
+	int fd;
+	// mapped driver buffers
+	std::vector<loopback_buf_t> bufs;
+	// bytes of a frame
+	size_t image = 0;
+	// buffers never queued yet, handed out before waiting on the driver
+	size_t fresh = 0;
+};
+
+// ioctl restarted when interrupted by a signal
+static int xioctl(int fd, unsigned long req, void *arg) {
+	int ret;
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
+static void release_buffers(loopback_stream_t *s) {
+	for (auto &b : s->bufs)
+		if (b.data)
+			munmap(b.data, b.size);
+	s->bufs.clear();
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = 0;
+	req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	req.memory = V4L2_MEMORY_MMAP;
+	xioctl(s->fd, VIDIOC_REQBUFS, &req);
+}
+
+void *loopback_stream_new(int fdwr, size_t count, int debug) {
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	struct v4l2_format vid_format;
+	memset(&vid_format, 0, sizeof(vid_format));
+	vid_format.type = type;
+	if (xioctl(fdwr, VIDIOC_G_FMT, &vid_format) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to get device video format: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return nullptr;
+	}
+	// buffers can only be requested while not streaming
+	xioctl(fdwr, VIDIOC_STREAMOFF, &type);
+
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = count;
+	req.type = type;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(fdwr, VIDIOC_REQBUFS, &req) < 0 || req.count < 2) {
+		if (debug)
+			fprintf(stderr, "%s:%d(%s): No mmap streaming, using write(): %s\n", __FILE__, __LINE__, __func__,
+				req.count ? strerror(errno) : "too few buffers");
+		auto s = loopback_stream_t{fdwr};
+		release_buffers(&s);
+		xioctl(fdwr, VIDIOC_STREAMON, &type);
+		return nullptr;
+	}
+
+	loopback_stream_t *s = new loopback_stream_t{fdwr};
+	s->image = vid_format.fmt.pix.sizeimage;
+	for (unsigned i = 0; i < req.count; i++) {
+		struct v4l2_buffer vb;
+		memset(&vb, 0, sizeof(vb));
+		vb.index = i;
+		vb.type = type;
+		vb.memory = V4L2_MEMORY_MMAP;
+		if (xioctl(fdwr, VIDIOC_QUERYBUF, &vb) < 0) {
+			fprintf(stderr, "%s:%d(%s): Failed to query buffer %u: %s\n", __FILE__, __LINE__, __func__, i, strerror(errno));
+			break;
+		}
+		void *data = mmap(nullptr, vb.length, PROT_READ|PROT_WRITE, MAP_SHARED, fdwr, vb.m.offset);
+		if (data == MAP_FAILED) {
+			fprintf(stderr, "%s:%d(%s): Failed to map buffer %u: %s\n", __FILE__, __LINE__, __func__, i, strerror(errno));
+			break;
+		}
+		loopback_buf_t b;
+		b.data = (uint8_t *)data;
+		b.size = vb.length;
+		b.stride = vid_format.fmt.pix.bytesperline;
+		b.index = i;
+		s->bufs.push_back(b);
+	}
+	if (s->bufs.size() < req.count || s->bufs[0].size < s->image) {
+		release_buffers(s);
+		delete s;
+		xioctl(fdwr, VIDIOC_STREAMON, &type);
+		return nullptr;
+	}
+	if (xioctl(fdwr, VIDIOC_STREAMON, &type) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to start streaming: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		release_buffers(s);
+		delete s;
+		return nullptr;
+	}
+	if (debug)
+		printf("loopback: %zu mmap buffers of %zu bytes\n", s->bufs.size(), s->bufs[0].size);
+	return s;
+}
+
+void loopback_stream_delete(void *stream) {
+	loopback_stream_t *s = (loopback_stream_t *)stream;
+	if (!s)
+		return;
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	xioctl(s->fd, VIDIOC_STREAMOFF, &type);
+	release_buffers(s);
+	delete s;
+}
+
+bool loopback_dequeue(void *stream, loopback_buf_t &buf) {
+	loopback_stream_t *s = (loopback_stream_t *)stream;
+	if (!s)
+		return false;
+	if (s->fresh < s->bufs.size()) {
+		buf = s->bufs[s->fresh++];
+		return true;
+	}
+	struct v4l2_buffer vb;
+	memset(&vb, 0, sizeof(vb));
+	vb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	vb.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(s->fd, VIDIOC_DQBUF, &vb) < 0 || vb.index >= s->bufs.size()) {
+		fprintf(stderr, "%s:%d(%s): Failed to dequeue buffer: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	buf = s->bufs[vb.index];
+	return true;
+}
+
+bool loopback_queue(void *stream, loopback_buf_t &buf, const struct timespec *ts) {
+	loopback_stream_t *s = (loopback_stream_t *)stream;
+	if (!s || buf.index < 0)
+		return false;
+	struct v4l2_buffer vb;
+	memset(&vb, 0, sizeof(vb));
+	vb.index = buf.index;
+	vb.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	vb.memory = V4L2_MEMORY_MMAP;
+	vb.field = V4L2_FIELD_NONE;
+	vb.bytesused = s->image;
+	if (ts) {
+		vb.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+		vb.timestamp.tv_sec = ts->tv_sec;
+		vb.timestamp.tv_usec = ts->tv_nsec / 1000;
+	}
+	if (xioctl(s->fd, VIDIOC_QBUF, &vb) < 0) {
+		fprintf(stderr, "%s:%d(%s): Failed to queue buffer: %s\n", __FILE__, __LINE__, __func__, strerror(errno));
+		return false;
+	}
+	buf.index = -1;
+	return true;
+}
+
 #ifdef standalone
 
 #define FRAME_WIDTH 640
@@ -4,9 +4,41 @@
 #ifndef _LOOPBACK_H_
 #define _LOOPBACK_H_
 
+#include <linux/videodev2.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 #include <string>
 
-int loopback_init(const std::string& device, int w, int h, int debug);
+// Open the device for output in pixfmt: V4L2_PIX_FMT_YUYV (default), NV12,
+// YUV420 (I420) announced as limited range BT.601 (default) or BT.709
+// Y'CbCr, or RGB24. Fails if the driver does not take the format.
+int loopback_init(const std::string& device, int w, int h, int debug, bool bt709 = false,
+	uint32_t pixfmt = V4L2_PIX_FMT_YUYV);
 int loopback_free(int fdwr);
 
+// Streaming I/O: frames are rendered straight into driver buffers mapped
+// into our address space and queued with their capture time, instead of
+// being copied in by write()
+
+// A driver buffer owned by us between dequeue and queue
+struct loopback_buf_t {
+	uint8_t *data = nullptr;
+	size_t size = 0;
+	size_t stride = 0;
+	int index = -1;
+};
+
+// Map count buffers of a device opened by loopback_init. Returns nullptr
+// if the driver does not support mmap streaming, write() still works then.
+void *loopback_stream_new(int fdwr, size_t count, int debug);
+// Unmap and release the buffers (before loopback_free)
+void loopback_stream_delete(void *stream);
+// Next buffer to fill: each buffer once, then the oldest one the driver
+// is done with (blocks until there is one)
+bool loopback_dequeue(void *stream, loopback_buf_t &buf);
+// Hand a filled buffer to the driver, stamped with ts (CLOCK_MONOTONIC,
+// nullptr: stamped by the driver)
+bool loopback_queue(void *stream, loopback_buf_t &buf, const struct timespec *ts);
+
 #endif // _LOOPBACK_H_